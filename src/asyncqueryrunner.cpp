@@ -0,0 +1,90 @@
+#include "asyncqueryrunner.h"
+#include <QDebug>
+
+AsyncQueryRunner::AsyncQueryRunner(DatabaseManager *dbManager, QObject *parent)
+    : QObject(parent)
+    , m_dbManager(dbManager)
+    , m_readDb(nullptr)
+    , m_generation(0)
+{
+    m_thread.setObjectName("QueryWorker");
+}
+
+AsyncQueryRunner::~AsyncQueryRunner()
+{
+    cancel();
+    m_thread.quit();
+    m_thread.wait();
+}
+
+void AsyncQueryRunner::start()
+{
+    if (m_readDb) {
+        return;
+    }
+
+    // The connection must be opened, used and closed on the worker thread
+    m_readDb = new DatabaseManager;
+    m_readDb->moveToThread(&m_thread);
+    connect(&m_thread, &QThread::finished, m_readDb, &QObject::deleteLater);
+    m_thread.start();
+
+    QMetaObject::invokeMethod(m_readDb, [readDb = m_readDb]() {
+        readDb->openReadConnection("QueryWorker");
+    }, Qt::QueuedConnection);
+}
+
+int AsyncQueryRunner::run(const Query &query, const Callback &callback)
+{
+    if (!m_readDb) {
+        qWarning() << "AsyncQueryRunner::run called before start()";
+        return -1;
+    }
+
+    const int requestId = m_generation.fetchAndAddOrdered(1) + 1;
+    m_readDb->interrupt();
+
+    QMetaObject::invokeMethod(m_readDb, [this, readDb = m_readDb, requestId, query, callback]() {
+        // Superseded while it was still queued
+        if (!isLatest(requestId)) {
+            return;
+        }
+
+        QList<MusicTrack> tracks = query(readDb);
+
+        // An interrupt meant for the previous request can land on this one; retry once
+        if (readDb->lastQueryInterrupted() && isLatest(requestId)) {
+            tracks = query(readDb);
+        }
+
+        if (readDb->lastQueryInterrupted() || !isLatest(requestId)) {
+            return;
+        }
+
+        QMetaObject::invokeMethod(this, [this, requestId, tracks, callback]() mutable {
+            if (!isLatest(requestId)) {
+                return;
+            }
+            // The main connection may have interned names the worker has not loaded yet
+            m_dbManager->resolveNames(tracks);
+            callback(tracks);
+        }, Qt::QueuedConnection);
+    }, Qt::QueuedConnection);
+
+    return requestId;
+}
+
+int AsyncQueryRunner::searchTracks(const QString &searchTerm, const Callback &callback)
+{
+    return run([searchTerm](DatabaseManager *readDb) {
+        return readDb->searchTracks(searchTerm);
+    }, callback);
+}
+
+void AsyncQueryRunner::cancel()
+{
+    m_generation.fetchAndAddOrdered(1);
+    if (m_readDb) {
+        m_readDb->interrupt();
+    }
+}
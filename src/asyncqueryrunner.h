@@ -0,0 +1,46 @@
+#ifndef ASYNCQUERYRUNNER_H
+#define ASYNCQUERYRUNNER_H
+
+#include <QObject>
+#include <QThread>
+#include <QAtomicInt>
+#include <functional>
+#include "databasemanager.h"
+
+// Runs track queries on a worker thread with its own read-only connection,
+// so slow searches never block painting. Only the newest request is
+// delivered: starting a request interrupts the one in flight through
+// sqlite3_interrupt() and drops any result it still produces.
+class AsyncQueryRunner : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Runs on the worker thread against the read connection
+    using Query = std::function<QList<MusicTrack>(DatabaseManager *readDb)>;
+    // Runs on the caller's thread with names resolved from the main dictionaries
+    using Callback = std::function<void(const QList<MusicTrack> &tracks)>;
+
+    explicit AsyncQueryRunner(DatabaseManager *dbManager, QObject *parent = nullptr);
+    ~AsyncQueryRunner();
+
+    // Starts the worker thread and opens its connection; call once the main database is initialized
+    void start();
+
+    // Queues a query, superseding any earlier one; returns its request id
+    int run(const Query &query, const Callback &callback);
+    int searchTracks(const QString &searchTerm, const Callback &callback);
+
+    // Abandons the current request without starting a new one
+    void cancel();
+
+    bool isLatest(int requestId) const { return requestId == m_generation.loadAcquire(); }
+
+private:
+    DatabaseManager *m_dbManager;
+    DatabaseManager *m_readDb; // lives on m_thread
+    QThread m_thread;
+    QAtomicInt m_generation;
+};
+
+#endif // ASYNCQUERYRUNNER_H
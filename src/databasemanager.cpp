@@ -1,203 +1,1423 @@
 #include "databasemanager.h"
+#include "trackcursor.h"
+#include "sqlitestatement.h"
 #include <QSqlError>
+#include <QSqlDriver>
+#include <QElapsedTimer>
 #include <QStandardPaths>
 #include <QDir>
+#include <QRegularExpression>
 #include <QDebug>
+#include <sqlite3.h>
 
 DatabaseManager::DatabaseManager(QObject *parent)
     : QObject(parent)
+    , m_revision(0)
+    , m_storedRevision(0)
+    , m_prunedRevision(0)
+    , m_syncedRevision(0)
+    , m_nativeHandle(nullptr)
+    , m_nativeHandleChecked(false)
+    , m_interruptHandle(nullptr)
+    , m_ownedHandle(nullptr)
+    , m_lastQueryInterrupted(false)
+    , m_transactionDepth(0)
+    , m_maintenanceTimer(nullptr)
+    , m_maintenanceIdleDelay(0)
+    , m_maintenancePaused(false)
+    , m_maintenanceStep(MaintenanceIdle)
+    , m_maintenanceArmedRevision(-1)
+    , m_maintainedRevision(-1)
+    , m_vacuumedPages(0)
+    , m_vacuumElapsedMs(0)
+    , m_vacuumConversionReported(false)
 {
 }
 
 DatabaseManager::~DatabaseManager()
 {
+    const QString connectionName = m_database.connectionName();
+
+    if (m_ownedHandle) {
+        m_interruptHandle.storeRelease(nullptr);
+        sqlite3_close_v2(m_ownedHandle);
+    }
+
     if (m_database.isOpen()) {
         m_database.close();
     }
+
+    // Worker connections are registered per manager, so release the name with it
+    if (!connectionName.isEmpty() && connectionName != QLatin1String(QSqlDatabase::defaultConnection)) {
+        m_database = QSqlDatabase();
+        QSqlDatabase::removeDatabase(connectionName);
+    }
+}
+
+static QString databasePath()
+{
+    QString dataPath = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    return dataPath + "/ongaku.db";
+}
+
+bool DatabaseManager::initialize()
+{
+    // Create database directory if it doesn't exist
+    QString dataPath = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dataPath);
+
+    // Setup database connection
+    m_database = QSqlDatabase::addDatabase("QSQLITE");
+    m_database.setDatabaseName(databasePath());
+
+    if (!m_database.open()) {
+        qWarning() << "Failed to open database:" << m_database.lastError().text();
+        return false;
+    }
+
+    // Only takes effect on a new file, and must come before WAL is enabled;
+    // existing libraries need a full VACUUM, which maintenance only reports
+    QSqlQuery query("PRAGMA auto_vacuum = INCREMENTAL", m_database);
+
+    // WAL lets the read connection keep searching while the scanner writes
+    query.exec("PRAGMA journal_mode = WAL");
+
+    return createTables();
+}
+
+bool DatabaseManager::openReadConnection(const QString &connectionName)
+{
+    m_database = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    m_database.setDatabaseName(databasePath());
+    m_database.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=2000");
+
+    if (!m_database.open()) {
+        qWarning() << "Failed to open read connection:" << m_database.lastError().text();
+        return false;
+    }
+
+    // Track reads get a connection of their own on the linked libsqlite3, so
+    // interrupt() works whatever SQLite copy the Qt driver was built with
+    sqlite3 *handle = nullptr;
+    if (sqlite3_open_v2(databasePath().toUtf8().constData(), &handle, SQLITE_OPEN_READONLY, nullptr) == SQLITE_OK) {
+        sqlite3_busy_timeout(handle, 2000);
+        m_ownedHandle = handle;
+        m_nativeHandle = handle;
+        m_nativeHandleChecked = true;
+        m_interruptHandle.storeRelease(handle);
+    } else {
+        qWarning() << "Failed to open native read connection:" << sqlite3_errmsg(handle);
+        sqlite3_close(handle);
+        nativeHandle();
+    }
+
+    // The writer connection owns the schema
+    return loadDictionaries() && loadRevision();
+}
+
+// Bump when the schema changes and add a matching step to migrateSchema()
+static const int SchemaVersion = 9;
+
+// Keyset comparisons skip NULLs, so sortable text columns are stored as ''
+static QString nonNull(const QString &value)
+{
+    return value.isNull() ? QString("") : value;
+}
+
+// Paths are stored as a directories row plus the file name. Qt paths always use '/'.
+static QString directoryOf(const QString &filePath)
+{
+    const int slash = filePath.lastIndexOf('/');
+    return slash < 0 ? QString("") : filePath.left(slash);
+}
+
+static QString fileNameOf(const QString &filePath)
+{
+    return filePath.mid(filePath.lastIndexOf('/') + 1);
+}
+
+static QString joinPath(const QString &directory, const QString &fileName)
+{
+    return directory + '/' + fileName;
+}
+
+// SQL spellings of the helpers above, for migrating and reporting full paths
+static const char *DirectoryOfSql = "substr(%1, 1, length(rtrim(%1, replace(%1, '/', ''))) - 1)";
+static const char *FileNameOfSql = "substr(%1, length(rtrim(%1, replace(%1, '/', ''))) + 1)";
+static const char *FullPathSql = "(SELECT name FROM directories WHERE id = t.directory_id) || '/' || t.file_name";
+
+// Column list shared by every track query; decoders read these by position
+static const char *TrackColumns = "t.id, t.directory_id, t.file_name, t.title, t.artist_id, t.album_id, t.genre_id, "
+                                  "t.publisher_id, t.catalog_number, t.year, t.track_number, t.duration, "
+                                  "t.file_size, t.mtime_ns, t.revision, t.field_set, t.extractor_version";
+
+enum TrackField {
+    IdField = 0,
+    DirectoryIdField,
+    FileNameField,
+    TitleField,
+    ArtistIdField,
+    AlbumIdField,
+    GenreIdField,
+    PublisherIdField,
+    CatalogNumberField,
+    YearField,
+    TrackNumberField,
+    DurationField,
+    FileSizeField,
+    MtimeNsField,
+    RevisionField,
+    FieldSetField,
+    ExtractorVersionField
+};
+
+// Hot queries, shared with checkQueryPlans() so the checked SQL is the SQL that runs
+static const char *AllTracksQuery = R"(
+    SELECT %1 FROM tracks t
+    JOIN artists ar ON ar.id = t.artist_id
+    JOIN albums al ON al.id = t.album_id
+    ORDER BY ar.name, al.name, t.track_number
+)";
+
+static const char *AlbumsByArtistQuery = R"(
+    SELECT t.album_id, COUNT(*)
+    FROM tracks t
+    JOIN albums al ON al.id = t.album_id
+    WHERE t.artist_id = ?
+    GROUP BY t.album_id
+    ORDER BY al.name
+)";
+
+static const char *TracksByAlbumQuery =
+    "SELECT %1 FROM tracks t WHERE t.artist_id = ? AND t.album_id = ? ORDER BY t.track_number";
+
+// Tracks of one group in the order the grouped trees list them
+static const char *TracksInGroupQuery = R"(
+    SELECT %1 FROM tracks t
+    JOIN artists ar ON ar.id = t.artist_id
+    JOIN albums al ON al.id = t.album_id
+    WHERE %2
+    ORDER BY ar.name, al.name, t.track_number
+)";
+
+static const char *TrackByPathQuery = "SELECT %1 FROM tracks t WHERE t.directory_id = ? AND t.file_name = ?";
+
+static const char *ChangedTracksQuery = "SELECT %1 FROM tracks t WHERE t.revision > ? ORDER BY t.revision";
+
+static const char *StaleTrackPathsQuery = "SELECT %1 FROM tracks t WHERE t.field_set = ? AND t.extractor_version < ?";
+
+// Matches the search term against the title and the artist, album and genre dictionaries
+static const char *SearchCondition = R"(
+    (t.title LIKE ?
+     OR t.artist_id IN (SELECT id FROM artists WHERE name LIKE ?)
+     OR t.album_id IN (SELECT id FROM albums WHERE name LIKE ?)
+     OR t.genre_id IN (SELECT id FROM genres WHERE name LIKE ?))
+)";
+
+bool FileSignature::matches(const FileSignature &other) const
+{
+    if (size != other.size) {
+        return false;
+    }
+    if (mtimeNs == other.mtimeNs) {
+        return true;
+    }
+
+    // Rows migrated from DATETIME text only kept milliseconds
+    const qint64 nsPerMs = 1000000;
+    bool truncated = mtimeNs % nsPerMs == 0 || other.mtimeNs % nsPerMs == 0;
+    return truncated && mtimeNs / nsPerMs == other.mtimeNs / nsPerMs;
+}
+
+void LibraryDictionary::insert(int id, const QString &name)
+{
+    m_names.insert(id, name);
+    m_ids.insert(name, id);
+}
+
+void LibraryDictionary::clear()
+{
+    m_names.clear();
+    m_ids.clear();
+}
+
+// Current tracks table; migrations that rebuild it create it under another name first
+static const char *TracksTableSchema = R"(
+    CREATE TABLE IF NOT EXISTS %1 (
+        id INTEGER PRIMARY KEY AUTOINCREMENT,
+        directory_id INTEGER NOT NULL REFERENCES directories(id),
+        file_name TEXT NOT NULL,
+        title TEXT,
+        artist_id INTEGER NOT NULL REFERENCES artists(id),
+        album_id INTEGER NOT NULL REFERENCES albums(id),
+        genre_id INTEGER NOT NULL REFERENCES genres(id),
+        publisher_id INTEGER NOT NULL REFERENCES publishers(id),
+        catalog_number TEXT,
+        year INTEGER,
+        track_number INTEGER,
+        duration INTEGER,
+        file_size INTEGER,
+        mtime_ns INTEGER,
+        revision INTEGER NOT NULL DEFAULT 0,
+        field_set INTEGER NOT NULL DEFAULT 0,
+        extractor_version INTEGER NOT NULL DEFAULT 0,
+        created_at DATETIME DEFAULT CURRENT_TIMESTAMP,
+        updated_at DATETIME DEFAULT CURRENT_TIMESTAMP,
+        UNIQUE (directory_id, file_name)
+    )
+)";
+
+static const char *MaintenanceLogSchema = R"(
+    CREATE TABLE IF NOT EXISTS maintenance_log (
+        id INTEGER PRIMARY KEY,
+        ran_at DATETIME DEFAULT CURRENT_TIMESTAMP,
+        task TEXT NOT NULL,
+        duration_ms INTEGER,
+        detail TEXT
+    )
+)";
+
+static const char *PlayStatsSchema = R"(
+    CREATE TABLE IF NOT EXISTS play_stats (
+        track_id INTEGER PRIMARY KEY,
+        play_count INTEGER NOT NULL DEFAULT 0,
+        skip_count INTEGER NOT NULL DEFAULT 0,
+        last_played_ms INTEGER NOT NULL DEFAULT 0
+    )
+)";
+
+// Single row holding the highest revision ever handed out, so pruning tombstones
+// or rolling back a batch never lets the revision go backwards, and the newest
+// revision whose tombstones were pruned
+static const char *LibraryMetaSchema = R"(
+    CREATE TABLE IF NOT EXISTS library_meta (
+        id INTEGER PRIMARY KEY CHECK (id = 1),
+        revision INTEGER NOT NULL DEFAULT 0,
+        pruned_revision INTEGER NOT NULL DEFAULT 0
+    )
+)";
+
+static const char *SeedLibraryMetaQuery = R"(
+    INSERT OR IGNORE INTO library_meta (id, revision)
+    SELECT 1, MAX(COALESCE((SELECT MAX(revision) FROM tracks), 0),
+                  COALESCE((SELECT MAX(revision) FROM track_tombstones), 0))
+)";
+
+bool DatabaseManager::createTables()
+{
+    QSqlQuery query(m_database);
+
+    if (m_database.tables().contains("tracks")) {
+        int version = schemaVersion();
+        if (version < SchemaVersion && !migrateSchema(version)) {
+            return false;
+        }
+        return createIndexes() && loadDictionaries() && loadRevision();
+    }
+
+    // Artist, album, genre and publisher strings are stored once in their own
+    // dimension tables and referenced from tracks by integer id
+    QStringList createTableSQL = {
+        "CREATE TABLE IF NOT EXISTS artists (id INTEGER PRIMARY KEY, name TEXT UNIQUE NOT NULL)",
+        "CREATE TABLE IF NOT EXISTS albums (id INTEGER PRIMARY KEY, name TEXT UNIQUE NOT NULL)",
+        "CREATE TABLE IF NOT EXISTS genres (id INTEGER PRIMARY KEY, name TEXT UNIQUE NOT NULL)",
+        "CREATE TABLE IF NOT EXISTS publishers (id INTEGER PRIMARY KEY, name TEXT UNIQUE NOT NULL)",
+        "CREATE TABLE IF NOT EXISTS directories (id INTEGER PRIMARY KEY, name TEXT UNIQUE NOT NULL)",
+        QString(TracksTableSchema).arg("tracks"),
+        // Deleted rows leave a tombstone so incremental consumers see the removal
+        R"(
+            CREATE TABLE IF NOT EXISTS track_tombstones (
+                track_id INTEGER PRIMARY KEY,
+                file_path TEXT,
+                revision INTEGER NOT NULL
+            )
+        )",
+        MaintenanceLogSchema,
+        PlayStatsSchema,
+        LibraryMetaSchema,
+        SeedLibraryMetaQuery
+    };
+
+    for (const QString &tableSQL : createTableSQL) {
+        if (!query.exec(tableSQL)) {
+            qWarning() << "Failed to create tables:" << query.lastError().text();
+            return false;
+        }
+    }
+
+    return setSchemaVersion(SchemaVersion) && createIndexes() && loadDictionaries() && loadRevision();
+}
+
+bool DatabaseManager::createIndexes()
+{
+    QSqlQuery query(m_database);
+
+    // Each index backs a query shape checked by checkQueryPlans(). Single-column
+    // indexes also carry the rowid, giving the (value, id) order cursors seek on.
+    QStringList indexes = {
+        "DROP INDEX IF EXISTS idx_file_path", // Duplicated the UNIQUE constraint's index
+        // Path lookups use the UNIQUE (directory_id, file_name) index
+        "CREATE INDEX IF NOT EXISTS idx_artist_album_track ON tracks(artist_id, album_id, track_number)",
+        "CREATE INDEX IF NOT EXISTS idx_artist_id ON tracks(artist_id)",
+        "CREATE INDEX IF NOT EXISTS idx_album_id ON tracks(album_id)",
+        "CREATE INDEX IF NOT EXISTS idx_genre_id ON tracks(genre_id)",
+        "CREATE INDEX IF NOT EXISTS idx_publisher_id ON tracks(publisher_id)",
+        "CREATE INDEX IF NOT EXISTS idx_title ON tracks(title)",
+        "CREATE INDEX IF NOT EXISTS idx_catalog_number ON tracks(catalog_number)",
+        "CREATE INDEX IF NOT EXISTS idx_year ON tracks(year)",
+        "CREATE INDEX IF NOT EXISTS idx_track_number ON tracks(track_number)",
+        "CREATE INDEX IF NOT EXISTS idx_duration ON tracks(duration)",
+        "CREATE INDEX IF NOT EXISTS idx_revision ON tracks(revision)",
+        "CREATE INDEX IF NOT EXISTS idx_extractor ON tracks(field_set, extractor_version)",
+        "CREATE INDEX IF NOT EXISTS idx_tombstone_revision ON track_tombstones(revision)"
+    };
+
+    for (const QString &indexSQL : indexes) {
+        if (!query.exec(indexSQL)) {
+            qWarning() << "Failed to create index:" << query.lastError().text();
+        }
+    }
+
+    return true;
+}
+
+int DatabaseManager::schemaVersion()
+{
+    QSqlQuery query("PRAGMA user_version", m_database);
+    if (query.next()) {
+        return query.value(0).toInt();
+    }
+    return 0;
+}
+
+bool DatabaseManager::setSchemaVersion(int version)
+{
+    QSqlQuery query(m_database);
+    if (!query.exec(QString("PRAGMA user_version = %1").arg(version))) {
+        qWarning() << "Failed to set schema version:" << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool DatabaseManager::migrateSchema(int fromVersion)
+{
+    qDebug() << "Migrating database schema from version" << fromVersion << "to" << SchemaVersion;
+
+    if (fromVersion < 1 && !migrateToNormalizedSchema()) {
+        return false;
+    }
+
+    if (fromVersion < 2 && !runMigration({
+            "UPDATE tracks SET title = '' WHERE title IS NULL",
+            "UPDATE tracks SET catalog_number = '' WHERE catalog_number IS NULL"
+        })) {
+        return false;
+    }
+
+    // DATETIME text was written by Qt in local time with millisecond precision
+    if (fromVersion < 3 && !runMigration({
+            "ALTER TABLE tracks ADD COLUMN mtime_ns INTEGER",
+            R"(
+                UPDATE tracks SET mtime_ns =
+                    CAST(ROUND((julianday(last_modified, 'utc') - 2440587.5) * 86400000.0) AS INTEGER) * 1000000
+                WHERE last_modified IS NOT NULL
+            )",
+            "ALTER TABLE tracks DROP COLUMN last_modified"
+        })) {
+        return false;
+    }
+
+    if (fromVersion < 4 && !runMigration({
+            "ALTER TABLE tracks ADD COLUMN revision INTEGER NOT NULL DEFAULT 0",
+            R"(
+                CREATE TABLE IF NOT EXISTS track_tombstones (
+                    track_id INTEGER PRIMARY KEY,
+                    file_path TEXT,
+                    revision INTEGER NOT NULL
+                )
+            )"
+        })) {
+        return false;
+    }
+
+    // The shared directory prefix is stored once; the UNIQUE key moves to (directory_id, file_name)
+    if (fromVersion < 5) {
+        const QString directory = QString(DirectoryOfSql).arg("t.file_path");
+        const QString fileName = QString(FileNameOfSql).arg("t.file_path");
+        if (!runMigration({
+                "CREATE TABLE IF NOT EXISTS directories (id INTEGER PRIMARY KEY, name TEXT UNIQUE NOT NULL)",
+                QString("INSERT OR IGNORE INTO directories (name) SELECT DISTINCT %1 FROM tracks t").arg(directory),
+                QString(TracksTableSchema).arg("tracks_by_directory"),
+                QString(R"(
+                    INSERT INTO tracks_by_directory (id, directory_id, file_name, title, artist_id, album_id,
+                                                     genre_id, publisher_id, catalog_number, year, track_number,
+                                                     duration, file_size, mtime_ns, revision, created_at, updated_at)
+                    SELECT t.id, d.id, %2, t.title, t.artist_id, t.album_id,
+                           t.genre_id, t.publisher_id, t.catalog_number, t.year, t.track_number,
+                           t.duration, t.file_size, t.mtime_ns, t.revision, t.created_at, t.updated_at
+                    FROM tracks t
+                    JOIN directories d ON d.name = %1
+                )").arg(directory, fileName),
+                "DROP TABLE tracks",
+                "ALTER TABLE tracks_by_directory RENAME TO tracks"
+            })) {
+            return false;
+        }
+    }
+
+    if (fromVersion < 6 && !runMigration({MaintenanceLogSchema})) {
+        return false;
+    }
+
+    if (fromVersion < 7 && !runMigration({PlayStatsSchema})) {
+        return false;
+    }
+
+    // Existing rows get extractor version 0, so the next stale re-extraction rereads them once.
+    // A table rebuilt by the version 5 step already has the columns.
+    if (fromVersion >= 5 && fromVersion < 8 && !runMigration({
+            "ALTER TABLE tracks ADD COLUMN field_set INTEGER NOT NULL DEFAULT 0",
+            "ALTER TABLE tracks ADD COLUMN extractor_version INTEGER NOT NULL DEFAULT 0"
+        })) {
+        return false;
+    }
+
+    if (fromVersion < 9 && !runMigration({LibraryMetaSchema, SeedLibraryMetaQuery})) {
+        return false;
+    }
+
+    return setSchemaVersion(SchemaVersion);
+}
+
+bool DatabaseManager::migrateToNormalizedSchema()
+{
+    QSqlQuery query(m_database);
+
+    // Databases from before the publisher/catalog columns existed
+    query.exec("ALTER TABLE tracks ADD COLUMN publisher TEXT"); // Ignore errors for existing columns
+    query.exec("ALTER TABLE tracks ADD COLUMN catalog_number TEXT");
+
+    QStringList migrationQueries = {
+        "CREATE TABLE IF NOT EXISTS artists (id INTEGER PRIMARY KEY, name TEXT UNIQUE NOT NULL)",
+        "CREATE TABLE IF NOT EXISTS albums (id INTEGER PRIMARY KEY, name TEXT UNIQUE NOT NULL)",
+        "CREATE TABLE IF NOT EXISTS genres (id INTEGER PRIMARY KEY, name TEXT UNIQUE NOT NULL)",
+        "CREATE TABLE IF NOT EXISTS publishers (id INTEGER PRIMARY KEY, name TEXT UNIQUE NOT NULL)",
+        "INSERT OR IGNORE INTO artists (name) SELECT DISTINCT COALESCE(artist, '') FROM tracks",
+        "INSERT OR IGNORE INTO albums (name) SELECT DISTINCT COALESCE(album, '') FROM tracks",
+        "INSERT OR IGNORE INTO genres (name) SELECT DISTINCT COALESCE(genre, '') FROM tracks",
+        "INSERT OR IGNORE INTO publishers (name) SELECT DISTINCT COALESCE(publisher, '') FROM tracks",
+        R"(
+            CREATE TABLE tracks_normalized (
+                id INTEGER PRIMARY KEY AUTOINCREMENT,
+                file_path TEXT UNIQUE NOT NULL,
+                title TEXT,
+                artist_id INTEGER NOT NULL REFERENCES artists(id),
+                album_id INTEGER NOT NULL REFERENCES albums(id),
+                genre_id INTEGER NOT NULL REFERENCES genres(id),
+                publisher_id INTEGER NOT NULL REFERENCES publishers(id),
+                catalog_number TEXT,
+                year INTEGER,
+                track_number INTEGER,
+                duration INTEGER,
+                file_size INTEGER,
+                last_modified DATETIME,
+                created_at DATETIME DEFAULT CURRENT_TIMESTAMP,
+                updated_at DATETIME DEFAULT CURRENT_TIMESTAMP
+            )
+        )",
+        R"(
+            INSERT INTO tracks_normalized (id, file_path, title, artist_id, album_id, genre_id, publisher_id,
+                                           catalog_number, year, track_number, duration, file_size,
+                                           last_modified, created_at, updated_at)
+            SELECT t.id, t.file_path, t.title, ar.id, al.id, g.id, p.id,
+                   t.catalog_number, t.year, t.track_number, t.duration, t.file_size,
+                   t.last_modified, t.created_at, t.updated_at
+            FROM tracks t
+            JOIN artists ar ON ar.name = COALESCE(t.artist, '')
+            JOIN albums al ON al.name = COALESCE(t.album, '')
+            JOIN genres g ON g.name = COALESCE(t.genre, '')
+            JOIN publishers p ON p.name = COALESCE(t.publisher, '')
+        )",
+        "DROP TABLE tracks",
+        "ALTER TABLE tracks_normalized RENAME TO tracks"
+    };
+
+    return runMigration(migrationQueries);
+}
+
+bool DatabaseManager::runMigration(const QStringList &statements)
+{
+    QSqlQuery query(m_database);
+
+    m_database.transaction();
+    for (const QString &migrationSQL : statements) {
+        if (!query.exec(migrationSQL)) {
+            qWarning() << "Schema migration failed:" << query.lastError().text();
+            m_database.rollback();
+            return false;
+        }
+    }
+    return m_database.commit();
+}
+
+bool DatabaseManager::loadDictionaries()
+{
+    QSqlQuery query(m_database);
+    query.setForwardOnly(true);
+
+    for (int dimension = 0; dimension < DimensionCount; ++dimension) {
+        LibraryDictionary &dictionary = m_dictionaries[dimension];
+        dictionary.clear();
+
+        if (!query.exec("SELECT id, name FROM " + dimensionTable(static_cast<Dimension>(dimension)))) {
+            qWarning() << "Failed to load dictionary:" << query.lastError().text();
+            return false;
+        }
+
+        while (query.next()) {
+            dictionary.insert(query.value(0).toInt(), query.value(1).toString());
+        }
+    }
+
+    return true;
+}
+
+bool DatabaseManager::loadRevision()
+{
+    // Rows written outside a transaction are newer than the stored high-water mark
+    QSqlQuery query(R"(
+        SELECT MAX(m.revision,
+                   COALESCE((SELECT MAX(revision) FROM tracks), 0),
+                   COALESCE((SELECT MAX(revision) FROM track_tombstones), 0)),
+               m.pruned_revision
+        FROM library_meta m
+    )", m_database);
+
+    if (!query.next()) {
+        qWarning() << "Failed to load library revision:" << query.lastError().text();
+        return false;
+    }
+
+    m_revision = query.value(0).toLongLong();
+    m_storedRevision = m_revision;
+    m_prunedRevision = query.value(1).toLongLong();
+    // No client outlives the process, so none needs tombstones from earlier sessions
+    m_syncedRevision = m_revision;
+    return true;
+}
+
+void DatabaseManager::consumeRevision(const QSqlQuery &query)
+{
+    if (query.numRowsAffected() > 0) {
+        ++m_revision;
+    }
+}
+
+bool DatabaseManager::storeRevision()
+{
+    if (m_revision == m_storedRevision) {
+        return true;
+    }
+
+    QSqlQuery query(m_database);
+    query.prepare("UPDATE library_meta SET revision = MAX(revision, ?)");
+    query.addBindValue(m_revision);
+    if (!query.exec()) {
+        qWarning() << "Failed to store library revision:" << query.lastError().text();
+        return false;
+    }
+
+    m_storedRevision = m_revision;
+    return true;
+}
+
+QString DatabaseManager::dimensionTable(Dimension dimension)
+{
+    switch (dimension) {
+        case ArtistDimension: return "artists";
+        case AlbumDimension: return "albums";
+        case GenreDimension: return "genres";
+        case PublisherDimension: return "publishers";
+        case DirectoryDimension: return "directories";
+        default: return QString();
+    }
+}
+
+const LibraryDictionary &DatabaseManager::dictionary(Dimension dimension) const
+{
+    return m_dictionaries[dimension];
+}
+
+int DatabaseManager::pathDirectoryId(const QString &filePath) const
+{
+    return m_dictionaries[DirectoryDimension].id(directoryOf(filePath));
+}
+
+int DatabaseManager::internValue(Dimension dimension, const QString &value)
+{
+    // Missing tags are stored as the empty string so every track has an id
+    const QString name = nonNull(value);
+
+    LibraryDictionary &dictionary = m_dictionaries[dimension];
+    int id = dictionary.id(name);
+    if (id >= 0) {
+        return id;
+    }
+
+    QSqlQuery query(m_database);
+    query.prepare("INSERT INTO " + dimensionTable(dimension) + " (name) VALUES (?)");
+    query.addBindValue(name);
+
+    if (!query.exec()) {
+        qWarning() << "Failed to intern value:" << query.lastError().text();
+        return -1;
+    }
+
+    id = query.lastInsertId().toInt();
+    dictionary.insert(id, name);
+    return id;
+}
+
+bool DatabaseManager::addTrack(const MusicTrack &track)
+{
+    QSqlQuery query(m_database);
+    query.prepare(R"(
+        INSERT INTO tracks (directory_id, file_name, title, artist_id, album_id, genre_id, publisher_id,
+                           catalog_number, year, track_number, duration, file_size, mtime_ns, revision,
+                           field_set, extractor_version)
+        VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+    )");
+
+    int directoryId = internValue(DirectoryDimension, directoryOf(track.filePath));
+    if (directoryId < 0) {
+        return false;
+    }
+    query.addBindValue(directoryId);
+    query.addBindValue(fileNameOf(track.filePath));
+    query.addBindValue(nonNull(track.title));
+    if (!bindDimensionIds(query, track)) {
+        return false;
+    }
+    query.addBindValue(nonNull(track.catalogNumber));
+    query.addBindValue(track.year);
+    query.addBindValue(track.track);
+    query.addBindValue(track.duration);
+    query.addBindValue(track.fileSize);
+    query.addBindValue(track.mtimeNs);
+    query.addBindValue(pendingRevision());
+    query.addBindValue(track.fieldSet);
+    query.addBindValue(track.extractorVersion);
+
+    if (!query.exec()) {
+        qWarning() << "Failed to add track:" << query.lastError().text();
+        return false;
+    }
+
+    consumeRevision(query);
+    return true;
+}
+
+bool DatabaseManager::updateTrack(const MusicTrack &track)
+{
+    QSqlQuery query(m_database);
+    query.prepare(R"(
+        UPDATE tracks SET title=?, artist_id=?, album_id=?, genre_id=?, publisher_id=?, catalog_number=?, year=?,
+                         track_number=?, duration=?, file_size=?, mtime_ns=?, revision=?,
+                         field_set=?, extractor_version=?, updated_at=CURRENT_TIMESTAMP
+        WHERE directory_id=? AND file_name=?
+    )");
+
+    query.addBindValue(nonNull(track.title));
+    if (!bindDimensionIds(query, track)) {
+        return false;
+    }
+    query.addBindValue(nonNull(track.catalogNumber));
+    query.addBindValue(track.year);
+    query.addBindValue(track.track);
+    query.addBindValue(track.duration);
+    query.addBindValue(track.fileSize);
+    query.addBindValue(track.mtimeNs);
+    query.addBindValue(pendingRevision());
+    query.addBindValue(track.fieldSet);
+    query.addBindValue(track.extractorVersion);
+    query.addBindValue(pathDirectoryId(track.filePath));
+    query.addBindValue(fileNameOf(track.filePath));
+
+    if (!query.exec()) {
+        return false;
+    }
+
+    // An unknown path matches no row and leaves the revision alone
+    consumeRevision(query);
+    return true;
+}
+
+bool DatabaseManager::importTracks(const QList<MusicTrack> &tracks)
+{
+    if (tracks.isEmpty()) {
+        return true;
+    }
+
+    if (!beginTransaction()) {
+        qWarning() << "Failed to start import transaction:" << m_database.lastError().text();
+        return false;
+    }
+
+    // One prepared upsert for the whole batch; re-importing a file overwrites its row
+    QSqlQuery query(m_database);
+    query.prepare(R"(
+        INSERT INTO tracks (directory_id, file_name, title, artist_id, album_id, genre_id, publisher_id,
+                           catalog_number, year, track_number, duration, file_size, mtime_ns, revision,
+                           field_set, extractor_version)
+        VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+        ON CONFLICT (directory_id, file_name) DO UPDATE SET
+            title = excluded.title, artist_id = excluded.artist_id, album_id = excluded.album_id,
+            genre_id = excluded.genre_id, publisher_id = excluded.publisher_id,
+            catalog_number = excluded.catalog_number, year = excluded.year,
+            track_number = excluded.track_number, duration = excluded.duration,
+            file_size = excluded.file_size, mtime_ns = excluded.mtime_ns, revision = excluded.revision,
+            field_set = excluded.field_set, extractor_version = excluded.extractor_version,
+            updated_at = CURRENT_TIMESTAMP
+    )");
+
+    for (const MusicTrack &track : tracks) {
+        int directoryId = internValue(DirectoryDimension, directoryOf(track.filePath));
+        bool bound = directoryId >= 0;
+        if (bound) {
+            query.addBindValue(directoryId);
+            query.addBindValue(fileNameOf(track.filePath));
+            query.addBindValue(nonNull(track.title));
+            bound = bindDimensionIds(query, track);
+        }
+        if (bound) {
+            query.addBindValue(nonNull(track.catalogNumber));
+            query.addBindValue(track.year);
+            query.addBindValue(track.track);
+            query.addBindValue(track.duration);
+            query.addBindValue(track.fileSize);
+            query.addBindValue(track.mtimeNs);
+            query.addBindValue(pendingRevision());
+            query.addBindValue(track.fieldSet);
+            query.addBindValue(track.extractorVersion);
+        }
+
+        if (!bound || !query.exec()) {
+            qWarning() << "Failed to import track" << track.filePath << ":" << query.lastError().text();
+            rollbackTransaction();
+            return false;
+        }
+        consumeRevision(query);
+    }
+
+    return commitTransaction();
+}
+
+bool DatabaseManager::bindDimensionIds(QSqlQuery &query, const MusicTrack &track)
+{
+    const QString values[] = { track.artist, track.album, track.genre, track.publisher };
+
+    for (int dimension = ArtistDimension; dimension <= PublisherDimension; ++dimension) {
+        int id = internValue(static_cast<Dimension>(dimension), values[dimension]);
+        if (id < 0) {
+            return false;
+        }
+        query.addBindValue(id);
+    }
+
+    return true;
+}
+
+bool DatabaseManager::removeTrack(int id)
+{
+    QSqlQuery query(m_database);
+    query.prepare(QString(R"(
+        INSERT OR REPLACE INTO track_tombstones (track_id, file_path, revision)
+        SELECT t.id, %1, ? FROM tracks t WHERE t.id = ?
+    )").arg(FullPathSql));
+    query.addBindValue(pendingRevision());
+    query.addBindValue(id);
+    if (!query.exec()) {
+        qWarning() << "Failed to record tombstone:" << query.lastError().text();
+        return false;
+    }
+    consumeRevision(query);
+
+    query.prepare("DELETE FROM play_stats WHERE track_id = ?");
+    query.addBindValue(id);
+    query.exec();
+
+    query.prepare("DELETE FROM tracks WHERE id = ?");
+    query.addBindValue(id);
+    return query.exec();
+}
+
+bool DatabaseManager::removeTrackByPath(const QString &filePath)
+{
+    const int directoryId = pathDirectoryId(filePath);
+    if (directoryId < 0) {
+        return true; // No track was ever stored under this directory
+    }
+
+    QSqlQuery query(m_database);
+    query.prepare(R"(
+        INSERT OR REPLACE INTO track_tombstones (track_id, file_path, revision)
+        SELECT id, ?, ? FROM tracks WHERE directory_id = ? AND file_name = ?
+    )");
+    query.addBindValue(filePath);
+    query.addBindValue(pendingRevision());
+    query.addBindValue(directoryId);
+    query.addBindValue(fileNameOf(filePath));
+    if (!query.exec()) {
+        qWarning() << "Failed to record tombstone:" << query.lastError().text();
+        return false;
+    }
+    consumeRevision(query);
+
+    query.prepare("DELETE FROM play_stats WHERE track_id IN "
+                  "(SELECT id FROM tracks WHERE directory_id = ? AND file_name = ?)");
+    query.addBindValue(directoryId);
+    query.addBindValue(fileNameOf(filePath));
+    query.exec();
+
+    query.prepare("DELETE FROM tracks WHERE directory_id = ? AND file_name = ?");
+    query.addBindValue(directoryId);
+    query.addBindValue(fileNameOf(filePath));
+    return query.exec();
+}
+
+QList<MusicTrack> DatabaseManager::getAllTracks()
+{
+    return selectTracks(QString(AllTracksQuery).arg(TrackColumns));
+}
+
+QList<MusicTrack> DatabaseManager::searchTracks(const QString &searchTerm)
+{
+    QString searchPattern = "%" + searchTerm + "%";
+    QList<MusicTrack> tracks = selectTracks(QString(R"(
+        SELECT %1 FROM tracks t
+        JOIN artists ar ON ar.id = t.artist_id
+        JOIN albums al ON al.id = t.album_id
+        WHERE %2
+        ORDER BY ar.name, al.name, t.track_number
+    )").arg(TrackColumns, SearchCondition), {searchPattern, searchPattern, searchPattern, searchPattern});
+
+    qDebug() << "Search for '" << searchTerm << "' returned" << tracks.size() << "tracks";
+    return tracks;
+}
+
+QList<MusicTrack> DatabaseManager::getTracksByArtist(const QString &artist)
+{
+    return selectTracks(QString(R"(
+        SELECT %1 FROM tracks t
+        JOIN albums al ON al.id = t.album_id
+        WHERE t.artist_id = ?
+        ORDER BY al.name, t.track_number
+    )").arg(TrackColumns), {m_dictionaries[ArtistDimension].id(artist)});
+}
+
+QList<MusicTrack> DatabaseManager::getTracksByAlbum(const QString &album)
+{
+    return selectTracks(QString("SELECT %1 FROM tracks t WHERE t.album_id = ? ORDER BY t.track_number")
+                            .arg(TrackColumns), {m_dictionaries[AlbumDimension].id(album)});
+}
+
+QList<MusicTrack> DatabaseManager::getTracksByGenre(const QString &genre)
+{
+    return selectTracks(QString(R"(
+        SELECT %1 FROM tracks t
+        JOIN artists ar ON ar.id = t.artist_id
+        JOIN albums al ON al.id = t.album_id
+        WHERE t.genre_id = ?
+        ORDER BY ar.name, al.name, t.track_number
+    )").arg(TrackColumns), {m_dictionaries[GenreDimension].id(genre)});
+}
+
+QList<AlbumSummary> DatabaseManager::getAlbumsByArtist(int artistId)
+{
+    QList<AlbumSummary> albums;
+    QSqlQuery query(m_database);
+    query.setForwardOnly(true);
+    query.prepare(AlbumsByArtistQuery);
+    query.addBindValue(artistId);
+
+    if (!query.exec()) {
+        qWarning() << "getAlbumsByArtist query failed:" << query.lastError().text();
+        return albums;
+    }
+
+    while (query.next()) {
+        AlbumSummary album;
+        album.id = query.value(0).toInt();
+        album.name = m_dictionaries[AlbumDimension].name(album.id);
+        album.trackCount = query.value(1).toInt();
+        albums.append(album);
+    }
+
+    return albums;
+}
+
+QList<MusicTrack> DatabaseManager::getTracksByAlbum(int artistId, int albumId)
+{
+    return selectTracks(QString(TracksByAlbumQuery).arg(TrackColumns), {artistId, albumId});
+}
+
+QList<MusicTrack> DatabaseManager::getTracksByAlbumId(int albumId)
+{
+    return selectTracks(QString(TracksInGroupQuery).arg(TrackColumns, "t.album_id = ?"), {albumId});
+}
+
+QList<MusicTrack> DatabaseManager::getTracksByGenreId(int genreId)
+{
+    return selectTracks(QString(TracksInGroupQuery).arg(TrackColumns, "t.genre_id = ?"), {genreId});
+}
+
+QList<MusicTrack> DatabaseManager::getTracksByYear(int year)
+{
+    if (year <= 0) {
+        return selectTracks(QString(TracksInGroupQuery).arg(TrackColumns, "(t.year IS NULL OR t.year <= 0)"));
+    }
+    return selectTracks(QString(TracksInGroupQuery).arg(TrackColumns, "t.year = ?"), {year});
+}
+
+QList<MusicTrack> DatabaseManager::getTrackPage(SortColumn column, Qt::SortOrder order,
+                                                const QVariant &afterValue, int afterId,
+                                                int pageSize, const QString &searchTerm)
+{
+    const bool firstPage = afterId < 0;
+    const QString sql = trackPageQuery(column, order, firstPage, !searchTerm.isEmpty());
+
+    QVariantList bindValues;
+    if (!firstPage) {
+        // Path order is a (directory, file name) pair
+        if (afterValue.typeId() == QMetaType::QVariantList) {
+            bindValues << afterValue.toList();
+        } else if (column != SortById) {
+            bindValues << afterValue;
+        }
+        bindValues << afterId;
+    }
+    if (!searchTerm.isEmpty()) {
+        QString searchPattern = "%" + searchTerm + "%";
+        bindValues << searchPattern << searchPattern << searchPattern << searchPattern;
+    }
+    bindValues << pageSize;
+
+    return selectTracks(sql, bindValues);
+}
+
+QString DatabaseManager::trackPageQuery(SortColumn column, Qt::SortOrder order, bool firstPage, bool filtered)
+{
+    // Rows are ordered by (sort value, id) so every page resumes exactly after the
+    // last row of the previous one through an index seek instead of an OFFSET scan
+    QStringList sortTerms;
+    QString join;
+    switch (column) {
+        case SortById: break;
+        case SortByTitle: sortTerms << "t.title"; break;
+        case SortByCatalogNumber: sortTerms << "t.catalog_number"; break;
+        case SortByYear: sortTerms << "t.year"; break;
+        case SortByTrackNumber: sortTerms << "t.track_number"; break;
+        case SortByDuration: sortTerms << "t.duration"; break;
+        case SortByFilePath:
+            // Walks directories by name, then each directory's files through the UNIQUE index
+            sortTerms << "d.name" << "t.file_name";
+            join = "JOIN directories d ON d.id = t.directory_id";
+            break;
+        case SortByArtist:
+            sortTerms << "d.name";
+            join = "JOIN artists d ON d.id = t.artist_id";
+            break;
+        case SortByAlbum:
+            sortTerms << "d.name";
+            join = "JOIN albums d ON d.id = t.album_id";
+            break;
+        case SortByGenre:
+            sortTerms << "d.name";
+            join = "JOIN genres d ON d.id = t.genre_id";
+            break;
+        case SortByPublisher:
+            sortTerms << "d.name";
+            join = "JOIN publishers d ON d.id = t.publisher_id";
+            break;
+    }
+    sortTerms << "t.id";
+
+    const bool ascending = order == Qt::AscendingOrder;
+    QStringList conditions;
+
+    if (!firstPage) {
+        if (sortTerms.size() == 1) {
+            conditions << QString("t.id %1 ?").arg(ascending ? ">" : "<");
+        } else {
+            QStringList placeholders;
+            for (int i = 0; i < sortTerms.size(); ++i) {
+                placeholders << "?";
+            }
+            conditions << QString("(%1) %2 (%3)").arg(sortTerms.join(", "), ascending ? ">" : "<",
+                                                      placeholders.join(", "));
+        }
+    }
+    if (filtered) {
+        conditions << SearchCondition;
+    }
+
+    QString sql = QString("SELECT %1 FROM tracks t ").arg(TrackColumns) + join;
+    if (!conditions.isEmpty()) {
+        sql += " WHERE " + conditions.join(" AND ");
+    }
+    sql += " ORDER BY " + sortTerms.join(ascending ? " ASC, " : " DESC, ") + (ascending ? " ASC" : " DESC");
+    sql += " LIMIT ?";
+    return sql;
+}
+
+QVariant DatabaseManager::sortValue(SortColumn column, const MusicTrack &track)
+{
+    switch (column) {
+        case SortById: return track.id;
+        case SortByTitle: return nonNull(track.title);
+        case SortByArtist: return nonNull(track.artist);
+        case SortByAlbum: return nonNull(track.album);
+        case SortByGenre: return nonNull(track.genre);
+        case SortByPublisher: return nonNull(track.publisher);
+        case SortByCatalogNumber: return nonNull(track.catalogNumber);
+        case SortByYear: return track.year;
+        case SortByTrackNumber: return track.track;
+        case SortByDuration: return track.duration;
+        case SortByFilePath: return QVariantList{directoryOf(track.filePath), fileNameOf(track.filePath)};
+    }
+    return QVariant();
+}
+
+TrackCursor DatabaseManager::openCursor(SortColumn column, Qt::SortOrder order,
+                                        int pageSize, const QString &searchTerm)
+{
+    return TrackCursor(this, column, order, pageSize, searchTerm);
+}
+
+bool DatabaseManager::trackExists(const QString &filePath)
+{
+    QSqlQuery query(m_database);
+    query.prepare("SELECT 1 FROM tracks WHERE directory_id = ? AND file_name = ?");
+    query.addBindValue(pathDirectoryId(filePath));
+    query.addBindValue(fileNameOf(filePath));
+    query.exec();
+    return query.next();
+}
+
+TrackChanges DatabaseManager::getChangesSince(qint64 revision)
+{
+    TrackChanges changes;
+    changes.revision = m_revision;
+    if (revision < m_prunedRevision) {
+        changes.complete = false;
+        return changes;
+    }
+    m_syncedRevision = m_revision;
+    changes.changedTracks = selectTracks(QString(ChangedTracksQuery).arg(TrackColumns), {revision});
+
+    QSqlQuery query(m_database);
+    query.setForwardOnly(true);
+    query.prepare("SELECT track_id FROM track_tombstones WHERE revision > ? ORDER BY revision");
+    query.addBindValue(revision);
+
+    if (!query.exec()) {
+        qWarning() << "getChangesSince tombstone query failed:" << query.lastError().text();
+        return changes;
+    }
+
+    while (query.next()) {
+        changes.removedTrackIds.append(query.value(0).toInt());
+    }
+
+    return changes;
+}
+
+QHash<int, TrackStatistics> DatabaseManager::getPlayStatistics()
+{
+    QHash<int, TrackStatistics> statistics;
+    QSqlQuery query(m_database);
+    query.setForwardOnly(true);
+
+    if (!query.exec("SELECT track_id, play_count, skip_count, last_played_ms FROM play_stats")) {
+        qWarning() << "Failed to load play statistics:" << query.lastError().text();
+        return statistics;
+    }
+
+    while (query.next()) {
+        TrackStatistics &entry = statistics[query.value(0).toInt()];
+        entry.playCount = query.value(1).toInt();
+        entry.skipCount = query.value(2).toInt();
+        entry.lastPlayedMs = query.value(3).toLongLong();
+    }
+
+    return statistics;
 }
 
-bool DatabaseManager::initialize()
+bool DatabaseManager::addPlayStatistics(const QHash<int, TrackStatistics> &deltas)
 {
-    // Create database directory if it doesn't exist
-    QString dataPath = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
-    QDir().mkpath(dataPath);
-
-    // Setup database connection
-    m_database = QSqlDatabase::addDatabase("QSQLITE");
-    m_database.setDatabaseName(dataPath + "/ongaku.db");
+    if (deltas.isEmpty()) {
+        return true;
+    }
 
-    if (!m_database.open()) {
-        qWarning() << "Failed to open database:" << m_database.lastError().text();
+    // One transaction and one prepared statement for the whole batch
+    if (!m_database.transaction()) {
+        qWarning() << "Failed to start play statistics transaction:" << m_database.lastError().text();
         return false;
     }
 
-    return createTables();
+    QSqlQuery query(m_database);
+    query.prepare(R"(
+        INSERT INTO play_stats (track_id, play_count, skip_count, last_played_ms) VALUES (?, ?, ?, ?)
+        ON CONFLICT (track_id) DO UPDATE SET
+            play_count = play_count + excluded.play_count,
+            skip_count = skip_count + excluded.skip_count,
+            last_played_ms = MAX(last_played_ms, excluded.last_played_ms)
+    )");
+
+    for (auto it = deltas.constBegin(); it != deltas.constEnd(); ++it) {
+        query.addBindValue(it.key());
+        query.addBindValue(it.value().playCount);
+        query.addBindValue(it.value().skipCount);
+        query.addBindValue(it.value().lastPlayedMs);
+
+        if (!query.exec()) {
+            qWarning() << "Failed to write play statistics:" << query.lastError().text();
+            m_database.rollback();
+            return false;
+        }
+    }
+
+    return m_database.commit();
 }
 
-bool DatabaseManager::createTables()
+FileSignature DatabaseManager::getFileSignature(const QString &filePath)
 {
     QSqlQuery query(m_database);
+    query.prepare("SELECT file_size, mtime_ns FROM tracks WHERE directory_id = ? AND file_name = ?");
+    query.addBindValue(pathDirectoryId(filePath));
+    query.addBindValue(fileNameOf(filePath));
 
-    QString createTableSQL = R"(
-        CREATE TABLE IF NOT EXISTS tracks (
-            id INTEGER PRIMARY KEY AUTOINCREMENT,
-            file_path TEXT UNIQUE NOT NULL,
-            title TEXT,
-            artist TEXT,
-            album TEXT,
-            genre TEXT,
-            publisher TEXT,
-            catalog_number TEXT,
-            year INTEGER,
-            track_number INTEGER,
-            duration INTEGER,
-            file_size INTEGER,
-            last_modified DATETIME,
-            created_at DATETIME DEFAULT CURRENT_TIMESTAMP,
-            updated_at DATETIME DEFAULT CURRENT_TIMESTAMP
-        )
-    )";
-
-    if (!query.exec(createTableSQL)) {
-        qWarning() << "Failed to create tracks table:" << query.lastError().text();
-        return false;
+    if (query.exec() && query.next()) {
+        return FileSignature(query.value(0).toLongLong(), query.value(1).toLongLong());
     }
 
-    // Add migration for new columns if they don't exist
-    QStringList migrationQueries = {
-        "ALTER TABLE tracks ADD COLUMN publisher TEXT",
-        "ALTER TABLE tracks ADD COLUMN catalog_number TEXT"
-    };
+    return FileSignature();
+}
 
-    for (const QString &migrationSQL : migrationQueries) {
-        query.exec(migrationSQL); // Ignore errors for existing columns
-    }
+MusicTrack DatabaseManager::getTrackByPath(const QString &filePath)
+{
+    QList<MusicTrack> tracks = selectTracks(QString(TrackByPathQuery).arg(TrackColumns),
+                                            {pathDirectoryId(filePath), fileNameOf(filePath)});
+    return tracks.isEmpty() ? MusicTrack() : tracks.first();
+}
 
-    // Create indexes for better search performance
-    QStringList indexes = {
-        "CREATE INDEX IF NOT EXISTS idx_artist ON tracks(artist)",
-        "CREATE INDEX IF NOT EXISTS idx_album ON tracks(album)",
-        "CREATE INDEX IF NOT EXISTS idx_genre ON tracks(genre)",
-        "CREATE INDEX IF NOT EXISTS idx_title ON tracks(title)",
-        "CREATE INDEX IF NOT EXISTS idx_file_path ON tracks(file_path)"
-    };
+QStringList DatabaseManager::getStaleTrackPaths(const QHash<int, int> &currentVersions)
+{
+    QStringList paths;
+    QSqlQuery query(m_database);
+    query.prepare(QString(StaleTrackPathsQuery).arg(FullPathSql));
 
-    for (const QString &indexSQL : indexes) {
-        if (!query.exec(indexSQL)) {
-            qWarning() << "Failed to create index:" << query.lastError().text();
+    // One (field_set, extractor_version) index range per field set
+    for (auto it = currentVersions.constBegin(); it != currentVersions.constEnd(); ++it) {
+        query.addBindValue(it.key());
+        query.addBindValue(it.value());
+        if (!query.exec()) {
+            qWarning() << "Failed to find stale tracks:" << query.lastError().text();
+            return QStringList();
+        }
+        while (query.next()) {
+            paths.append(query.value(0).toString());
         }
     }
 
-    return true;
+    return paths;
 }
 
-bool DatabaseManager::addTrack(const MusicTrack &track)
+QStringList DatabaseManager::getAllArtists()
 {
-    QSqlQuery query(m_database);
-    query.prepare(R"(
-        INSERT INTO tracks (file_path, title, artist, album, genre, publisher, catalog_number, year, track_number,
-                           duration, file_size, last_modified)
-        VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
-    )");
+    QStringList artists;
+    QSqlQuery query(R"(
+        SELECT name FROM artists
+        WHERE name != '' AND EXISTS (SELECT 1 FROM tracks WHERE tracks.artist_id = artists.id)
+        ORDER BY name
+    )", m_database);
 
-    query.addBindValue(track.filePath);
-    query.addBindValue(track.title);
-    query.addBindValue(track.artist);
-    query.addBindValue(track.album);
-    query.addBindValue(track.genre);
-    query.addBindValue(track.publisher);
-    query.addBindValue(track.catalogNumber);
-    query.addBindValue(track.year);
-    query.addBindValue(track.track);
-    query.addBindValue(track.duration);
-    query.addBindValue(track.fileSize);
-    query.addBindValue(track.lastModified);
+    while (query.next()) {
+        artists.append(query.value(0).toString());
+    }
 
-    if (!query.exec()) {
-        qWarning() << "Failed to add track:" << query.lastError().text();
-        return false;
+    return artists;
+}
+
+QStringList DatabaseManager::getAllAlbums()
+{
+    QStringList albums;
+    QSqlQuery query(R"(
+        SELECT name FROM albums
+        WHERE name != '' AND EXISTS (SELECT 1 FROM tracks WHERE tracks.album_id = albums.id)
+        ORDER BY name
+    )", m_database);
+
+    while (query.next()) {
+        albums.append(query.value(0).toString());
     }
 
-    return true;
+    return albums;
 }
 
-bool DatabaseManager::updateTrack(const MusicTrack &track)
+QStringList DatabaseManager::getAllGenres()
 {
-    QSqlQuery query(m_database);
-    query.prepare(R"(
-        UPDATE tracks SET title=?, artist=?, album=?, genre=?, publisher=?, catalog_number=?, year=?, track_number=?,
-                         duration=?, file_size=?, last_modified=?, updated_at=CURRENT_TIMESTAMP
-        WHERE file_path=?
-    )");
+    QStringList genres;
+    QSqlQuery query(R"(
+        SELECT name FROM genres
+        WHERE name != '' AND EXISTS (SELECT 1 FROM tracks WHERE tracks.genre_id = genres.id)
+        ORDER BY name
+    )", m_database);
 
-    query.addBindValue(track.title);
-    query.addBindValue(track.artist);
-    query.addBindValue(track.album);
-    query.addBindValue(track.genre);
-    query.addBindValue(track.publisher);
-    query.addBindValue(track.catalogNumber);
-    query.addBindValue(track.year);
-    query.addBindValue(track.track);
-    query.addBindValue(track.duration);
-    query.addBindValue(track.fileSize);
-    query.addBindValue(track.lastModified);
-    query.addBindValue(track.filePath);
+    while (query.next()) {
+        genres.append(query.value(0).toString());
+    }
 
-    return query.exec();
+    return genres;
 }
 
-bool DatabaseManager::removeTrack(int id)
+int DatabaseManager::getTrackCount()
 {
-    QSqlQuery query(m_database);
-    query.prepare("DELETE FROM tracks WHERE id = ?");
-    query.addBindValue(id);
-    return query.exec();
+    QSqlQuery query("SELECT COUNT(*) FROM tracks", m_database);
+    if (query.exec() && query.next()) {
+        return query.value(0).toInt();
+    }
+    return 0;
 }
 
-bool DatabaseManager::removeTrackByPath(const QString &filePath)
+void DatabaseManager::clearDatabase()
 {
     QSqlQuery query(m_database);
-    query.prepare("DELETE FROM tracks WHERE file_path = ?");
-    query.addBindValue(filePath);
-    return query.exec();
+    query.prepare(QString(R"(
+        INSERT OR REPLACE INTO track_tombstones (track_id, file_path, revision)
+        SELECT t.id, %1, ? FROM tracks t
+    )").arg(FullPathSql));
+    query.addBindValue(pendingRevision());
+    if (query.exec()) {
+        consumeRevision(query);
+    }
+    query.exec("DELETE FROM tracks");
+    query.exec("DELETE FROM play_stats");
+
+    for (int dimension = 0; dimension < DimensionCount; ++dimension) {
+        query.exec("DELETE FROM " + dimensionTable(static_cast<Dimension>(dimension)));
+        m_dictionaries[dimension].clear();
+    }
 }
 
-QList<MusicTrack> DatabaseManager::getAllTracks()
+MusicTrack DatabaseManager::trackFromQuery(const QSqlQuery &query)
+{
+    MusicTrack track;
+    track.id = query.value(IdField).toInt();
+    track.directoryId = query.value(DirectoryIdField).toInt();
+    track.filePath = joinPath(m_dictionaries[DirectoryDimension].name(track.directoryId),
+                              query.value(FileNameField).toString());
+    track.title = query.value(TitleField).toString();
+    track.artistId = query.value(ArtistIdField).toInt();
+    track.albumId = query.value(AlbumIdField).toInt();
+    track.genreId = query.value(GenreIdField).toInt();
+    track.publisherId = query.value(PublisherIdField).toInt();
+    track.artist = m_dictionaries[ArtistDimension].name(track.artistId);
+    track.album = m_dictionaries[AlbumDimension].name(track.albumId);
+    track.genre = m_dictionaries[GenreDimension].name(track.genreId);
+    track.publisher = m_dictionaries[PublisherDimension].name(track.publisherId);
+    track.catalogNumber = query.value(CatalogNumberField).toString();
+    track.year = query.value(YearField).toInt();
+    track.track = query.value(TrackNumberField).toInt();
+    track.duration = query.value(DurationField).toInt();
+    track.fileSize = query.value(FileSizeField).toLongLong();
+    track.mtimeNs = query.value(MtimeNsField).toLongLong();
+    track.revision = query.value(RevisionField).toLongLong();
+    track.fieldSet = query.value(FieldSetField).toInt();
+    track.extractorVersion = query.value(ExtractorVersionField).toInt();
+    return track;
+}
+
+MusicTrack DatabaseManager::trackFromStatement(const SqliteStatement &statement)
+{
+    MusicTrack track;
+    track.id = statement.columnInt(IdField);
+    track.directoryId = statement.columnInt(DirectoryIdField);
+    track.filePath = joinPath(m_dictionaries[DirectoryDimension].name(track.directoryId),
+                              statement.columnText(FileNameField));
+    track.title = statement.columnText(TitleField);
+    track.artistId = statement.columnInt(ArtistIdField);
+    track.albumId = statement.columnInt(AlbumIdField);
+    track.genreId = statement.columnInt(GenreIdField);
+    track.publisherId = statement.columnInt(PublisherIdField);
+    track.artist = m_dictionaries[ArtistDimension].name(track.artistId);
+    track.album = m_dictionaries[AlbumDimension].name(track.albumId);
+    track.genre = m_dictionaries[GenreDimension].name(track.genreId);
+    track.publisher = m_dictionaries[PublisherDimension].name(track.publisherId);
+    track.catalogNumber = statement.columnText(CatalogNumberField);
+    track.year = statement.columnInt(YearField);
+    track.track = statement.columnInt(TrackNumberField);
+    track.duration = statement.columnInt(DurationField);
+    track.fileSize = statement.columnInt64(FileSizeField);
+    track.mtimeNs = statement.columnInt64(MtimeNsField);
+    track.revision = statement.columnInt64(RevisionField);
+    track.fieldSet = statement.columnInt(FieldSetField);
+    track.extractorVersion = statement.columnInt(ExtractorVersionField);
+    return track;
+}
+
+QList<MusicTrack> DatabaseManager::selectTracks(const QString &sql, const QVariantList &bindValues)
+{
+    if (nativeHandle()) {
+        return selectTracksNative(sql, bindValues);
+    }
+    return selectTracksWithQuery(sql, bindValues);
+}
+
+QList<MusicTrack> DatabaseManager::selectTracksNative(const QString &sql, const QVariantList &bindValues)
 {
     QList<MusicTrack> tracks;
-    QSqlQuery query("SELECT * FROM tracks ORDER BY artist, album, track_number", m_database);
+    SqliteStatement statement(nativeHandle(), sql);
+    m_lastQueryInterrupted = false;
+    m_lastQueryError.clear();
 
-    if (!query.exec()) {
-        qWarning() << "getAllTracks query failed:" << query.lastError().text();
+    if (!statement.isValid()) {
+        m_lastQueryError = statement.errorString();
+        qWarning() << "Track query failed:" << m_lastQueryError;
         return tracks;
     }
 
-    while (query.next()) {
-        tracks.append(trackFromQuery(query));
+    for (int i = 0; i < bindValues.size(); ++i) {
+        statement.bind(i + 1, bindValues.at(i));
     }
 
+    while (statement.step()) {
+        tracks.append(trackFromStatement(statement));
+    }
+
+    m_lastQueryInterrupted = statement.wasInterrupted();
+    if (statement.hasFailed()) {
+        m_lastQueryError = statement.wasInterrupted() ? QString("Query interrupted") : statement.errorString();
+    }
     return tracks;
 }
 
-QList<MusicTrack> DatabaseManager::searchTracks(const QString &searchTerm)
+QList<MusicTrack> DatabaseManager::selectTracksWithQuery(const QString &sql, const QVariantList &bindValues)
 {
     QList<MusicTrack> tracks;
     QSqlQuery query(m_database);
+    query.setForwardOnly(true);
+    query.prepare(sql);
 
-    query.prepare(R"(
-        SELECT * FROM tracks
-        WHERE title LIKE ? OR artist LIKE ? OR album LIKE ? OR genre LIKE ?
-        ORDER BY artist, album, track_number
-    )");
-
-    QString searchPattern = "%" + searchTerm + "%";
-    query.addBindValue(searchPattern);
-    query.addBindValue(searchPattern);
-    query.addBindValue(searchPattern);
-    query.addBindValue(searchPattern);
+    for (const QVariant &value : bindValues) {
+        query.addBindValue(value);
+    }
 
+    m_lastQueryError.clear();
     if (!query.exec()) {
-        qWarning() << "Search query failed:" << query.lastError().text();
+        m_lastQueryError = query.lastError().text();
+        qWarning() << "Track query failed:" << m_lastQueryError;
         return tracks;
     }
 
@@ -205,155 +1425,420 @@ QList<MusicTrack> DatabaseManager::searchTracks(const QString &searchTerm)
         tracks.append(trackFromQuery(query));
     }
 
-    qDebug() << "Search for '" << searchTerm << "' returned" << tracks.size() << "tracks";
+    // next() also returns false when stepping fails part way
+    if (query.lastError().isValid()) {
+        m_lastQueryError = query.lastError().text();
+        qWarning() << "Track query failed:" << m_lastQueryError;
+    }
     return tracks;
 }
 
-QList<MusicTrack> DatabaseManager::getTracksByArtist(const QString &artist)
+sqlite3 *DatabaseManager::nativeHandle()
 {
-    QList<MusicTrack> tracks;
-    QSqlQuery query(m_database);
-    query.prepare("SELECT * FROM tracks WHERE artist = ? ORDER BY album, track_number");
-    query.addBindValue(artist);
+    if (m_nativeHandleChecked || !m_database.isOpen()) {
+        return m_nativeHandle;
+    }
+    m_nativeHandleChecked = true;
 
-    while (query.next()) {
-        tracks.append(trackFromQuery(query));
+#ifndef ONGAKU_SHARED_SQLITE_DRIVER
+    // The build found a driver with its own SQLite copy; a handle from it
+    // must never reach this build's sqlite3 functions
+    qWarning() << "Qt SQLite driver does not use the shared libsqlite3;"
+               << "using QSqlQuery decoding, and queries cannot be interrupted";
+    return nullptr;
+#else
+    QVariant handle = m_database.driver()->handle();
+    if (!handle.isValid() || qstrcmp(handle.typeName(), "sqlite3*") != 0) {
+        qWarning() << "Qt SQLite driver exposes no sqlite3 handle; queries cannot be interrupted";
+        return nullptr;
     }
 
-    return tracks;
+    // Both load the same shared library, so the versions can only differ if it was swapped underneath
+    QSqlQuery query("SELECT sqlite_version()", m_database);
+    if (!query.next() || query.value(0).toString() != QString::fromLatin1(sqlite3_libversion())) {
+        qWarning() << "Qt SQLite driver differs from linked sqlite3;"
+                   << "using QSqlQuery decoding, and queries cannot be interrupted";
+        return nullptr;
+    }
+
+    m_nativeHandle = *static_cast<sqlite3 **>(handle.data());
+    m_interruptHandle.storeRelease(m_nativeHandle);
+    return m_nativeHandle;
+#endif
 }
 
-QList<MusicTrack> DatabaseManager::getTracksByAlbum(const QString &album)
+void DatabaseManager::interrupt()
 {
-    QList<MusicTrack> tracks;
-    QSqlQuery query(m_database);
-    query.prepare("SELECT * FROM tracks WHERE album = ? ORDER BY track_number");
-    query.addBindValue(album);
-
-    while (query.next()) {
-        tracks.append(trackFromQuery(query));
+    // sqlite3_interrupt() may be called from any thread while the connection is busy
+    if (sqlite3 *handle = m_interruptHandle.loadAcquire()) {
+        sqlite3_interrupt(handle);
     }
+}
 
-    return tracks;
+void DatabaseManager::resolveNames(QList<MusicTrack> &tracks) const
+{
+    for (MusicTrack &track : tracks) {
+        track.filePath = joinPath(m_dictionaries[DirectoryDimension].name(track.directoryId),
+                                  fileNameOf(track.filePath));
+        track.artist = m_dictionaries[ArtistDimension].name(track.artistId);
+        track.album = m_dictionaries[AlbumDimension].name(track.albumId);
+        track.genre = m_dictionaries[GenreDimension].name(track.genreId);
+        track.publisher = m_dictionaries[PublisherDimension].name(track.publisherId);
+    }
 }
 
-QList<MusicTrack> DatabaseManager::getTracksByGenre(const QString &genre)
+bool DatabaseManager::checkQueryPlans()
 {
-    QList<MusicTrack> tracks;
+    QList<QPair<QString, QString>> hotQueries = {
+        {"getAllTracks", QString(AllTracksQuery).arg(TrackColumns)},
+        {"getAlbumsByArtist", AlbumsByArtistQuery},
+        {"getTracksByAlbum", QString(TracksByAlbumQuery).arg(TrackColumns)},
+        {"getTracksByGenreId", QString(TracksInGroupQuery).arg(TrackColumns, "t.genre_id = ?")},
+        {"getTrackByPath", QString(TrackByPathQuery).arg(TrackColumns)},
+        {"getChangesSince", QString(ChangedTracksQuery).arg(TrackColumns)},
+        {"getStaleTrackPaths", QString(StaleTrackPathsQuery).arg(FullPathSql)}
+    };
+
+    for (int column = SortById; column <= SortByFilePath; ++column) {
+        for (Qt::SortOrder order : {Qt::AscendingOrder, Qt::DescendingOrder}) {
+            for (bool firstPage : {true, false}) {
+                for (bool filtered : {false, true}) {
+                    QString name = QString("getTrackPage(column %1, %2, %3 page%4)")
+                                       .arg(column)
+                                       .arg(order == Qt::AscendingOrder ? "ascending" : "descending")
+                                       .arg(firstPage ? "first" : "next")
+                                       .arg(filtered ? ", searched" : "");
+                    hotQueries.append({name, trackPageQuery(static_cast<SortColumn>(column), order, firstPage,
+                                                            filtered)});
+                }
+            }
+        }
+    }
+
+    // "SCAN t" since SQLite 3.36, "SCAN TABLE tracks AS t" before
+    static const QRegularExpression tracksScan("^SCAN (TABLE )?(t|tracks)( AS t)?( |$)");
+
+    bool allPassed = true;
     QSqlQuery query(m_database);
-    query.prepare("SELECT * FROM tracks WHERE genre = ? ORDER BY artist, album, track_number");
-    query.addBindValue(genre);
 
-    while (query.next()) {
-        tracks.append(trackFromQuery(query));
+    for (const auto &hotQuery : hotQueries) {
+        query.prepare("EXPLAIN QUERY PLAN " + hotQuery.second);
+        for (int i = 0; i < hotQuery.second.count('?'); ++i) {
+            query.addBindValue(QVariant());
+        }
+
+        if (!query.exec()) {
+            qWarning() << "Failed to explain" << hotQuery.first << ":" << query.lastError().text();
+            allPassed = false;
+            continue;
+        }
+
+        // A full scan of tracks followed by a sort of the whole result means no index matched
+        QStringList details;
+        bool scansTracks = false;
+        bool sortsResult = false;
+        while (query.next()) {
+            QString detail = query.value(3).toString();
+            details << detail;
+            if (tracksScan.match(detail).hasMatch()) {
+                scansTracks = true;
+            }
+            if (detail.startsWith("USE TEMP B-TREE FOR ORDER BY")) {
+                sortsResult = true;
+            }
+        }
+
+        if (scansTracks && sortsResult) {
+            qWarning() << "Query plan regression in" << hotQuery.first << ":" << details.join("; ");
+            allPassed = false;
+        } else {
+            qDebug() << hotQuery.first << ":" << details.join("; ");
+        }
     }
 
-    return tracks;
+    return allPassed;
 }
 
-bool DatabaseManager::trackExists(const QString &filePath)
+void DatabaseManager::benchmarkRowDecoding()
 {
-    QSqlQuery query(m_database);
-    query.prepare("SELECT 1 FROM tracks WHERE file_path = ?");
-    query.addBindValue(filePath);
-    query.exec();
-    return query.next();
+    const QString sql = QString("SELECT %1 FROM tracks t").arg(TrackColumns);
+    QElapsedTimer timer;
+
+    timer.start();
+    int queryRows = selectTracksWithQuery(sql, QVariantList()).size();
+    qint64 queryMs = qMax<qint64>(1, timer.elapsed());
+    qDebug() << "QSqlQuery decoding:" << queryRows << "rows in" << queryMs << "ms,"
+             << (queryRows * 1000 / queryMs) << "rows/s";
+
+    if (!nativeHandle()) {
+        qDebug() << "Native sqlite3 decoding unavailable";
+        return;
+    }
+
+    timer.restart();
+    int nativeRows = selectTracksNative(sql, QVariantList()).size();
+    qint64 nativeMs = qMax<qint64>(1, timer.elapsed());
+    qDebug() << "sqlite3 decoding:" << nativeRows << "rows in" << nativeMs << "ms,"
+             << (nativeRows * 1000 / nativeMs) << "rows/s";
 }
 
-MusicTrack DatabaseManager::getTrackByPath(const QString &filePath)
-{
-    QSqlQuery query(m_database);
-    query.prepare("SELECT * FROM tracks WHERE file_path = ?");
-    query.addBindValue(filePath);
+// Each slice stays under this budget so the GUI thread keeps painting
+static const int MaintenanceSliceMs = 50;
+static const int MaintenanceSliceGapMs = 200;
+static const int VacuumPagesPerStep = 64;
+static const int MaintenanceLogRows = 200;
 
-    if (query.exec() && query.next()) {
-        return trackFromQuery(query);
+void DatabaseManager::startMaintenance(int idleDelayMs)
+{
+    if (!m_maintenanceTimer) {
+        m_maintenanceTimer = new QTimer(this);
+        m_maintenanceTimer->setSingleShot(true);
+        connect(m_maintenanceTimer, &QTimer::timeout, this, &DatabaseManager::runMaintenanceSlice);
     }
 
-    return MusicTrack();
+    m_maintenanceIdleDelay = idleDelayMs;
+    armMaintenance();
 }
 
-QStringList DatabaseManager::getAllArtists()
+void DatabaseManager::setMaintenancePaused(bool paused)
 {
-    QStringList artists;
-    QSqlQuery query("SELECT DISTINCT artist FROM tracks WHERE artist IS NOT NULL AND artist != '' ORDER BY artist", m_database);
+    m_maintenancePaused = paused;
+    if (!m_maintenanceTimer) {
+        return;
+    }
 
-    while (query.next()) {
-        artists.append(query.value(0).toString());
+    // A paused cycle starts over from the idle wait; finished tasks are cheap to repeat
+    m_maintenanceStep = MaintenanceIdle;
+    if (paused) {
+        m_maintenanceTimer->stop();
+    } else {
+        armMaintenance();
     }
+}
 
-    return artists;
+void DatabaseManager::armMaintenance()
+{
+    m_maintenanceArmedRevision = m_revision;
+    m_maintenanceTimer->start(m_maintenanceIdleDelay);
 }
 
-QStringList DatabaseManager::getAllAlbums()
+void DatabaseManager::runMaintenanceSlice()
 {
-    QStringList albums;
-    QSqlQuery query("SELECT DISTINCT album FROM tracks WHERE album IS NOT NULL AND album != '' ORDER BY album", m_database);
+    if (m_maintenancePaused || !m_database.isOpen()) {
+        return;
+    }
 
-    while (query.next()) {
-        albums.append(query.value(0).toString());
+    if (m_maintenanceStep == MaintenanceIdle) {
+        // Writes during the wait mean the library is not idle yet; an unchanged
+        // library that was already maintained has nothing to do
+        if (m_revision != m_maintenanceArmedRevision || m_revision == m_maintainedRevision) {
+            armMaintenance();
+            return;
+        }
+        m_maintenanceStep = MaintenancePrune;
+        m_vacuumedPages = 0;
+        m_vacuumElapsedMs = 0;
     }
 
-    return albums;
+    // Never interleave with a caller's batch transaction. The depth covers every
+    // driver; the native check also catches transactions begun in raw SQL
+    sqlite3 *handle = nativeHandle();
+    if (m_transactionDepth > 0 || (handle && !sqlite3_get_autocommit(handle))) {
+        m_maintenanceTimer->start(MaintenanceSliceGapMs);
+        return;
+    }
+
+    QElapsedTimer slice;
+    slice.start();
+    QSqlQuery query(m_database);
+
+    switch (m_maintenanceStep) {
+        case MaintenancePrune:
+            // Tombstones only serve getChangesSince() callers that are still behind them;
+            // one that falls further back is told to reload instead
+            if (m_syncedRevision > m_prunedRevision) {
+                if (pruneTombstones(m_syncedRevision, query)) {
+                    recordMaintenance("prune_tombstones", slice.elapsed(),
+                                      QString("removed %1 tombstones").arg(query.numRowsAffected()));
+                }
+            }
+            m_maintenanceStep = MaintenanceVacuum;
+            break;
+
+        case MaintenanceVacuum: {
+            const int freePages = pragmaValue("freelist_count");
+
+            if (pragmaValue("auto_vacuum") != 2) {
+                // Libraries created before incremental mode need one full VACUUM to
+                // switch. It rewrites the whole file under an exclusive lock, so no
+                // connection can run it without stalling the GUI; say so once a
+                // quarter of the file is free and leave the pages alone
+                const int pageCount = pragmaValue("page_count");
+                if (freePages * 4 > pageCount && !m_vacuumConversionReported) {
+                    qWarning() << "Library database has" << freePages << "of" << pageCount
+                               << "pages free but predates incremental vacuum;"
+                               << "run VACUUM with PRAGMA auto_vacuum = INCREMENTAL while Ongaku is closed";
+                    m_vacuumConversionReported = true;
+                }
+                m_maintenanceStep = MaintenanceOptimize;
+                break;
+            }
+
+            int remaining = freePages;
+            while (remaining > 0 && slice.elapsed() < MaintenanceSliceMs) {
+                int released = incrementalVacuum(qMin(remaining, VacuumPagesPerStep));
+                if (released <= 0) {
+                    break;
+                }
+                m_vacuumedPages += released;
+                remaining = pragmaValue("freelist_count");
+            }
+            m_vacuumElapsedMs += slice.elapsed();
+
+            if (remaining <= 0 || slice.elapsed() < MaintenanceSliceMs) {
+                if (m_vacuumedPages > 0) {
+                    recordMaintenance("incremental_vacuum", m_vacuumElapsedMs,
+                                      QString("released %1 pages").arg(m_vacuumedPages));
+                }
+                m_maintenanceStep = MaintenanceOptimize;
+            }
+            break;
+        }
+
+        case MaintenanceOptimize:
+            // analysis_limit bounds the ANALYZE that optimize may run on large tables
+            query.exec("PRAGMA analysis_limit = 400");
+            if (query.exec("PRAGMA optimize")) {
+                recordMaintenance("optimize", slice.elapsed(), QString());
+            } else {
+                qWarning() << "Maintenance optimize failed:" << query.lastError().text();
+            }
+            m_maintenanceStep = MaintenanceCheckpoint;
+            break;
+
+        case MaintenanceCheckpoint:
+            // PASSIVE never waits on the search connection's readers
+            if (query.exec("PRAGMA wal_checkpoint(PASSIVE)") && query.next()) {
+                recordMaintenance("wal_checkpoint", slice.elapsed(),
+                                  QString("checkpointed %1 of %2 WAL frames")
+                                      .arg(query.value(2).toInt()).arg(query.value(1).toInt()));
+            }
+            m_maintenanceStep = MaintenanceIdle;
+            m_maintainedRevision = m_revision;
+            armMaintenance();
+            return;
+
+        case MaintenanceIdle:
+            break;
+    }
+
+    m_maintenanceTimer->start(MaintenanceSliceGapMs);
 }
 
-QStringList DatabaseManager::getAllGenres()
+bool DatabaseManager::pruneTombstones(qint64 revision, QSqlQuery &query)
 {
-    QStringList genres;
-    QSqlQuery query("SELECT DISTINCT genre FROM tracks WHERE genre IS NOT NULL AND genre != '' ORDER BY genre", m_database);
+    // The high-water mark goes in first, since the tombstones may hold the newest revision
+    m_storedRevision = -1;
+    bool success = m_database.transaction() && storeRevision();
+    if (success) {
+        query.prepare("UPDATE library_meta SET pruned_revision = ?");
+        query.addBindValue(revision);
+        success = query.exec();
+    }
+    if (success) {
+        query.prepare("DELETE FROM track_tombstones WHERE revision <= ?");
+        query.addBindValue(revision);
+        success = query.exec();
+    }
 
-    while (query.next()) {
-        genres.append(query.value(0).toString());
+    if (!success || !m_database.commit()) {
+        qWarning() << "Failed to prune tombstones:" << query.lastError().text();
+        m_database.rollback();
+        m_storedRevision = -1;
+        return false;
     }
 
-    return genres;
+    m_prunedRevision = revision;
+    return true;
 }
 
-int DatabaseManager::getTrackCount()
+int DatabaseManager::pragmaValue(const QString &pragma)
 {
-    QSqlQuery query("SELECT COUNT(*) FROM tracks", m_database);
-    if (query.exec() && query.next()) {
-        return query.value(0).toInt();
-    }
-    return 0;
+    QSqlQuery query("PRAGMA " + pragma, m_database);
+    return query.next() ? query.value(0).toInt() : 0;
 }
 
-void DatabaseManager::clearDatabase()
+int DatabaseManager::incrementalVacuum(int maxPages)
 {
-    QSqlQuery query("DELETE FROM tracks", m_database);
-    query.exec();
+    const int before = pragmaValue("freelist_count");
+
+    // The pragma frees one page per step and returns no columns, which QSqlQuery
+    // treats as a finished statement, so step it directly when possible
+    if (sqlite3 *handle = nativeHandle()) {
+        SqliteStatement statement(handle, QString("PRAGMA incremental_vacuum(%1)").arg(maxPages));
+        while (statement.step()) {
+        }
+    } else {
+        QSqlQuery query(m_database);
+        for (int i = 0; i < maxPages; ++i) {
+            query.exec("PRAGMA incremental_vacuum(1)");
+        }
+    }
+
+    return before - pragmaValue("freelist_count");
 }
 
-MusicTrack DatabaseManager::trackFromQuery(const QSqlQuery &query)
+void DatabaseManager::recordMaintenance(const QString &task, qint64 elapsedMs, const QString &detail)
 {
-    MusicTrack track;
-    track.id = query.value("id").toInt();
-    track.filePath = query.value("file_path").toString();
-    track.title = query.value("title").toString();
-    track.artist = query.value("artist").toString();
-    track.album = query.value("album").toString();
-    track.genre = query.value("genre").toString();
-    track.publisher = query.value("publisher").toString();
-    track.catalogNumber = query.value("catalog_number").toString();
-    track.year = query.value("year").toInt();
-    track.track = query.value("track_number").toInt();
-    track.duration = query.value("duration").toInt();
-    track.fileSize = query.value("file_size").toLongLong();
-    track.lastModified = query.value("last_modified").toDateTime();
-    return track;
+    qDebug() << "Maintenance:" << task << "took" << elapsedMs << "ms" << detail;
+
+    QSqlQuery query(m_database);
+    query.prepare("INSERT INTO maintenance_log (task, duration_ms, detail) VALUES (?, ?, ?)");
+    query.addBindValue(task);
+    query.addBindValue(elapsedMs);
+    query.addBindValue(detail);
+    if (!query.exec()) {
+        qWarning() << "Failed to record maintenance:" << query.lastError().text();
+        return;
+    }
+
+    query.prepare("DELETE FROM maintenance_log WHERE id <= (SELECT MAX(id) FROM maintenance_log) - ?");
+    query.addBindValue(MaintenanceLogRows);
+    query.exec();
 }
 
 bool DatabaseManager::beginTransaction()
 {
-    return m_database.transaction();
+    if (!m_database.transaction()) {
+        return false;
+    }
+    ++m_transactionDepth;
+    return true;
 }
 
 bool DatabaseManager::commitTransaction()
 {
-    return m_database.commit();
+    // The high-water mark commits with the batch
+    storeRevision();
+    if (!m_database.commit()) {
+        m_storedRevision = -1;
+        return false;
+    }
+    m_transactionDepth = qMax(0, m_transactionDepth - 1);
+    return true;
 }
 
 bool DatabaseManager::rollbackTransaction()
 {
-    return m_database.rollback();
+    bool success = m_database.rollback();
+    m_transactionDepth = qMax(0, m_transactionDepth - 1);
+
+    // The discarded rows took revisions that clients may already have seen, and
+    // the rolled-back batch may have held the stored high-water mark
+    m_storedRevision = -1;
+    storeRevision();
+
+    // Values interned during the transaction no longer exist
+    loadDictionaries();
+    return success;
 }
@@ -7,12 +7,19 @@
 #include <QString>
 #include <QStringList>
 #include <QVariant>
-#include <QDateTime>
+#include <QHash>
+#include <QAtomicPointer>
+#include <QTimer>
 
 struct MusicTrack {
     int id;
     QString filePath;
+    int directoryId; // directories row holding the parent of filePath
     QString title;
+    int artistId;
+    int albumId;
+    int genreId;
+    int publisherId;
     QString artist;
     QString album;
     QString genre;
@@ -22,24 +29,122 @@ struct MusicTrack {
     int track;
     int duration; // in seconds
     qint64 fileSize;
-    QDateTime lastModified;
+    qint64 mtimeNs; // modification time, nanoseconds since the epoch
+    qint64 revision; // library revision of the last insert or update
+    int fieldSet; // MusicScanner::TagFieldSet that read the tags
+    int extractorVersion; // version of that field set's extractor, 0 if unknown
 
-    MusicTrack() : id(-1), year(0), track(0), duration(0), fileSize(0) {}
+    MusicTrack() : id(-1), directoryId(-1), artistId(-1), albumId(-1), genreId(-1), publisherId(-1),
+                   year(0), track(0), duration(0), fileSize(0), mtimeNs(0), revision(0),
+                   fieldSet(0), extractorVersion(0) {}
 };
 
+// Rows inserted, updated or deleted after a given library revision
+struct TrackChanges {
+    qint64 revision; // newest revision covered; pass it to the next getChangesSince()
+    QList<MusicTrack> changedTracks;
+    QList<int> removedTrackIds;
+    bool complete; // false when the removals were pruned; reload everything instead
+
+    TrackChanges() : revision(0), complete(true) {}
+    bool isEmpty() const { return changedTracks.isEmpty() && removedTrackIds.isEmpty(); }
+};
+
+// Cheap change-detection key for a file: if size and mtime match the stored
+// values the file is assumed unchanged and its tags are not re-read
+struct FileSignature {
+    qint64 size;
+    qint64 mtimeNs;
+
+    FileSignature() : size(-1), mtimeNs(-1) {}
+    FileSignature(qint64 size, qint64 mtimeNs) : size(size), mtimeNs(mtimeNs) {}
+
+    bool isValid() const { return size >= 0; }
+    bool matches(const FileSignature &other) const;
+};
+
+// Aggregate rows used to browse the library without loading every track
+struct AlbumSummary {
+    int id;
+    QString name;
+    int trackCount;
+
+    AlbumSummary() : id(-1), trackCount(0) {}
+};
+
+// Per-track listening history. Also used for unflushed deltas, where the
+// counts are increments and lastPlayedMs is the newest play in the batch.
+struct TrackStatistics {
+    int playCount;
+    int skipCount;
+    qint64 lastPlayedMs; // milliseconds since the epoch, 0 if never played
+
+    TrackStatistics() : playCount(0), skipCount(0), lastPlayedMs(0) {}
+};
+
+// Interned string values for one dimension table (artists, albums, ...).
+// Names handed out by the dictionary share storage, so every track that
+// references the same artist holds the same QString data.
+class LibraryDictionary
+{
+public:
+    QString name(int id) const { return m_names.value(id); }
+    int id(const QString &name) const { return m_ids.value(name, -1); }
+    int size() const { return m_names.size(); }
+
+    void insert(int id, const QString &name);
+    void clear();
+
+private:
+    QHash<int, QString> m_names;
+    QHash<QString, int> m_ids;
+};
+
+class TrackCursor;
+class SqliteStatement;
+struct sqlite3;
+
 class DatabaseManager : public QObject
 {
     Q_OBJECT
 
 public:
+    enum Dimension {
+        ArtistDimension = 0,
+        AlbumDimension,
+        GenreDimension,
+        PublisherDimension,
+        DirectoryDimension, // Parent directories of file paths, not a tag
+        DimensionCount
+    };
+
+    // Columns the cursor API can order by; ties are broken by track id
+    enum SortColumn {
+        SortById = 0,
+        SortByTitle,
+        SortByArtist,
+        SortByAlbum,
+        SortByGenre,
+        SortByPublisher,
+        SortByCatalogNumber,
+        SortByYear,
+        SortByTrackNumber,
+        SortByDuration,
+        SortByFilePath
+    };
+
     explicit DatabaseManager(QObject *parent = nullptr);
     ~DatabaseManager();
 
     bool initialize();
+    // Opens the existing library read-only on a named connection, for use from a worker thread
+    bool openReadConnection(const QString &connectionName);
     bool addTrack(const MusicTrack &track);
     bool updateTrack(const MusicTrack &track);
     bool removeTrack(int id);
     bool removeTrackByPath(const QString &filePath);
+    // Inserts or overwrites (by path) a batch of tracks in one transaction
+    bool importTracks(const QList<MusicTrack> &tracks);
 
     QList<MusicTrack> getAllTracks();
     QList<MusicTrack> searchTracks(const QString &searchTerm);
@@ -47,25 +152,144 @@ public:
     QList<MusicTrack> getTracksByAlbum(const QString &album);
     QList<MusicTrack> getTracksByGenre(const QString &genre);
 
+    // Browse queries for the tree view, each served by idx_artist_album_track
+    QList<AlbumSummary> getAlbumsByArtist(int artistId);
+    QList<MusicTrack> getTracksByAlbum(int artistId, int albumId);
+    QList<MusicTrack> getTracksByAlbumId(int albumId);
+    QList<MusicTrack> getTracksByGenreId(int genreId);
+    QList<MusicTrack> getTracksByYear(int year);
+
+    // Keyset-paginated reads for streaming large libraries in constant memory.
+    // Pass afterId < 0 for the first page, then the sort value and id of the last row.
+    QList<MusicTrack> getTrackPage(SortColumn column, Qt::SortOrder order,
+                                   const QVariant &afterValue, int afterId,
+                                   int pageSize, const QString &searchTerm = QString());
+    TrackCursor openCursor(SortColumn column, Qt::SortOrder order = Qt::AscendingOrder,
+                           int pageSize = 1000, const QString &searchTerm = QString());
+    static QVariant sortValue(SortColumn column, const MusicTrack &track);
+
+    // Every insert, update and delete that changes a row bumps the library revision,
+    // so consumers can resync in O(changes) instead of reloading the whole table.
+    // Maintenance prunes tombstones every caller has caught up past.
+    qint64 currentRevision() const { return m_revision; }
+    TrackChanges getChangesSince(qint64 revision);
+
+    // Play statistics live in their own table so counting a play never rewrites a track row
+    QHash<int, TrackStatistics> getPlayStatistics();
+    bool addPlayStatistics(const QHash<int, TrackStatistics> &deltas);
+
     bool trackExists(const QString &filePath);
+    FileSignature getFileSignature(const QString &filePath);
     MusicTrack getTrackByPath(const QString &filePath);
+    // Paths of tracks written by an older extractor than currentVersions lists for their field set
+    QStringList getStaleTrackPaths(const QHash<int, int> &currentVersions);
 
     QStringList getAllArtists();
     QStringList getAllAlbums();
     QStringList getAllGenres();
 
+    // Shared string dictionaries for the normalized dimension columns
+    const LibraryDictionary &dictionary(Dimension dimension) const;
+    int internValue(Dimension dimension, const QString &value);
+
     int getTrackCount();
     void clearDatabase();
 
+    // Aborts the statement running on this connection; safe to call from any thread.
+    // Read connections always support it; on the main connection it does nothing
+    // when the Qt driver does not share our libsqlite3 (logged on open).
+    void interrupt();
+    bool lastQueryInterrupted() const { return m_lastQueryInterrupted; }
+    // Set when the last track read failed, so a short result is not mistaken for the end
+    bool lastQueryFailed() const { return !m_lastQueryError.isEmpty(); }
+    QString lastQueryError() const { return m_lastQueryError; }
+
+    // Fills the name fields from this manager's dictionaries, e.g. for rows read on another connection
+    void resolveNames(QList<MusicTrack> &tracks) const;
+
+    // Runs EXPLAIN QUERY PLAN over the hot queries; false if any needs a full scan plus sort
+    bool checkQueryPlans();
+
+    // Logs rows/s for the QSqlQuery and native sqlite3 decoders over the whole library
+    void benchmarkRowDecoding();
+
+    // Idle-time upkeep: tombstone pruning, incremental vacuum, PRAGMA optimize and a WAL checkpoint run
+    // in short slices on this thread once the library has been quiet for idleDelayMs. Each task is
+    // logged and recorded in the maintenance_log table.
+    void startMaintenance(int idleDelayMs = 60000);
+    void setMaintenancePaused(bool paused);
+
     // Transaction support for batch operations
     bool beginTransaction();
     bool commitTransaction();
     bool rollbackTransaction();
 
+private slots:
+    void runMaintenanceSlice();
+
 private:
+    enum MaintenanceStep {
+        MaintenanceIdle,
+        MaintenancePrune,
+        MaintenanceVacuum,
+        MaintenanceOptimize,
+        MaintenanceCheckpoint
+    };
+
     QSqlDatabase m_database;
+    LibraryDictionary m_dictionaries[DimensionCount];
+    qint64 m_revision;
+    qint64 m_storedRevision; // high-water mark last written to library_meta
+    qint64 m_prunedRevision; // tombstones at or below this were deleted
+    qint64 m_syncedRevision; // revision the last getChangesSince() caller caught up to
+    sqlite3 *m_nativeHandle;
+    bool m_nativeHandleChecked;
+    QAtomicPointer<sqlite3> m_interruptHandle;
+    sqlite3 *m_ownedHandle; // Read connections' own sqlite3 connection, for track reads
+    bool m_lastQueryInterrupted;
+    QString m_lastQueryError;
+    int m_transactionDepth; // open beginTransaction() batches; maintenance waits for zero
+
+    QTimer *m_maintenanceTimer;
+    int m_maintenanceIdleDelay;
+    bool m_maintenancePaused;
+    MaintenanceStep m_maintenanceStep;
+    qint64 m_maintenanceArmedRevision; // revision when the idle wait started
+    qint64 m_maintainedRevision; // revision the last completed cycle ran at
+    int m_vacuumedPages;
+    qint64 m_vacuumElapsedMs;
+    bool m_vacuumConversionReported; // Once per session for non-incremental files
+
     bool createTables();
+    bool createIndexes();
+    bool loadDictionaries();
+    bool loadRevision();
+    // Writes are stamped with the next revision, which is only taken once a row changes
+    qint64 pendingRevision() const { return m_revision + 1; }
+    void consumeRevision(const QSqlQuery &query);
+    bool storeRevision();
+    bool bindDimensionIds(QSqlQuery &query, const MusicTrack &track);
+    int pathDirectoryId(const QString &filePath) const;
+    int schemaVersion();
+    bool setSchemaVersion(int version);
+    bool migrateSchema(int fromVersion);
+    bool migrateToNormalizedSchema();
+    bool runMigration(const QStringList &statements);
+    void armMaintenance();
+    int pragmaValue(const QString &pragma);
+    int incrementalVacuum(int maxPages);
+    void recordMaintenance(const QString &task, qint64 elapsedMs, const QString &detail);
+    bool pruneTombstones(qint64 revision, QSqlQuery &query);
+    static QString trackPageQuery(SortColumn column, Qt::SortOrder order, bool firstPage, bool filtered);
+    static QString dimensionTable(Dimension dimension);
     MusicTrack trackFromQuery(const QSqlQuery &query);
+    MusicTrack trackFromStatement(const SqliteStatement &statement);
+
+    // Bulk track reads go through sqlite3 directly when the driver allows it
+    sqlite3 *nativeHandle();
+    QList<MusicTrack> selectTracks(const QString &sql, const QVariantList &bindValues = QVariantList());
+    QList<MusicTrack> selectTracksNative(const QString &sql, const QVariantList &bindValues);
+    QList<MusicTrack> selectTracksWithQuery(const QString &sql, const QVariantList &bindValues);
 };
 
 #endif // DATABASEMANAGER_H
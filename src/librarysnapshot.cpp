@@ -0,0 +1,381 @@
+#include "librarysnapshot.h"
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QDebug>
+#include <cstring>
+
+static const char SnapshotMagic[8] = {'O', 'N', 'G', 'K', 'S', 'N', 'A', 'P'};
+
+// Bump when the layout below or the stored sort orders change; older files are
+// then ignored and rewritten. 3: text columns are stored in collation order.
+// 4: extractor field set and version per track.
+static const quint32 SnapshotVersion = 4;
+
+// All sections are 8-byte aligned and stored in native byte order; the file
+// is a local cache, never shared between machines
+struct SnapshotHeader {
+    char magic[8];
+    quint32 version;
+    quint32 trackCount;
+    qint64 revision;
+    quint32 orderKey;
+    quint32 permutationCount;
+    quint64 recordsOffset;
+    quint64 permutationsOffset;
+    quint64 stringsOffset;
+    quint64 stringsLength; // in UTF-16 code units
+};
+
+struct StringRef {
+    quint32 offset; // in UTF-16 code units from the start of the pool
+    quint32 length;
+};
+
+struct TrackRecord {
+    qint64 fileSize;
+    qint64 mtimeNs;
+    qint64 revision;
+    qint32 id;
+    qint32 directoryId;
+    qint32 fieldSet;
+    qint32 extractorVersion;
+    qint32 artistId;
+    qint32 albumId;
+    qint32 genreId;
+    qint32 publisherId;
+    qint32 year;
+    qint32 track;
+    qint32 duration;
+    qint32 reserved;
+    StringRef directory; // paths are split like the tracks table, so the pool holds each directory once
+    StringRef fileName;
+    StringRef title;
+    StringRef artist;
+    StringRef album;
+    StringRef genre;
+    StringRef publisher;
+    StringRef catalogNumber;
+};
+
+struct PermutationEntry {
+    quint32 orderKey;
+    quint32 reserved;
+    quint64 offset;
+};
+
+static_assert(sizeof(SnapshotHeader) == 64, "snapshot header layout changed");
+static_assert(sizeof(TrackRecord) == 136, "snapshot record layout changed");
+static_assert(sizeof(PermutationEntry) == 16, "snapshot permutation layout changed");
+
+static quint64 alignTo8(quint64 value)
+{
+    return (value + 7) & ~quint64(7);
+}
+
+// Appends strings to the pool once and hands out references to the shared copy
+class StringPoolBuilder
+{
+public:
+    StringRef add(const QString &value)
+    {
+        auto it = m_refs.constFind(value);
+        if (it != m_refs.constEnd()) {
+            return it.value();
+        }
+
+        StringRef ref = {quint32(m_pool.size()), quint32(value.size())};
+        m_pool.append(value);
+        m_refs.insert(value, ref);
+        return ref;
+    }
+
+    const QString &pool() const { return m_pool; }
+
+private:
+    QString m_pool;
+    QHash<QString, StringRef> m_refs;
+};
+
+LibrarySnapshot::LibrarySnapshot()
+    : m_data(nullptr)
+    , m_size(0)
+{
+}
+
+LibrarySnapshot::~LibrarySnapshot()
+{
+    close();
+}
+
+QString LibrarySnapshot::defaultPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/library.snapshot";
+}
+
+bool LibrarySnapshot::write(const QString &path, qint64 revision, const QList<MusicTrack> &tracks,
+                            quint32 orderKey, const QHash<quint32, QVector<quint32>> &permutations)
+{
+    StringPoolBuilder strings;
+    QVector<TrackRecord> records;
+    records.reserve(tracks.size());
+
+    for (const MusicTrack &track : tracks) {
+        TrackRecord record;
+        std::memset(&record, 0, sizeof(record));
+        record.fileSize = track.fileSize;
+        record.mtimeNs = track.mtimeNs;
+        record.revision = track.revision;
+        record.id = track.id;
+        record.directoryId = track.directoryId;
+        record.fieldSet = track.fieldSet;
+        record.extractorVersion = track.extractorVersion;
+        record.artistId = track.artistId;
+        record.albumId = track.albumId;
+        record.genreId = track.genreId;
+        record.publisherId = track.publisherId;
+        record.year = track.year;
+        record.track = track.track;
+        record.duration = track.duration;
+        const int slash = track.filePath.lastIndexOf('/');
+        record.directory = strings.add(track.filePath.left(qMax(slash, 0)));
+        record.fileName = strings.add(track.filePath.mid(slash + 1));
+        record.title = strings.add(track.title);
+        record.artist = strings.add(track.artist);
+        record.album = strings.add(track.album);
+        record.genre = strings.add(track.genre);
+        record.publisher = strings.add(track.publisher);
+        record.catalogNumber = strings.add(track.catalogNumber);
+        records.append(record);
+    }
+
+    QList<quint32> orderKeys;
+    QList<QVector<quint32>> orders;
+    for (auto it = permutations.constBegin(); it != permutations.constEnd(); ++it) {
+        if (it.value().size() != records.size()) {
+            qWarning() << "Skipping snapshot permutation with wrong length for order" << it.key();
+            continue;
+        }
+        orderKeys.append(it.key());
+        orders.append(it.value());
+    }
+
+    const quint64 permutationsOffset = sizeof(SnapshotHeader) + quint64(records.size()) * sizeof(TrackRecord);
+    quint64 offset = permutationsOffset + quint64(orders.size()) * sizeof(PermutationEntry);
+    QVector<PermutationEntry> entries;
+
+    for (int i = 0; i < orders.size(); ++i) {
+        PermutationEntry entry = {orderKeys.at(i), 0, offset};
+        entries.append(entry);
+        offset = alignTo8(offset + quint64(orders.at(i).size()) * sizeof(quint32));
+    }
+
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SnapshotMagic, sizeof(header.magic));
+    header.version = SnapshotVersion;
+    header.trackCount = quint32(records.size());
+    header.revision = revision;
+    header.orderKey = orderKey;
+    header.permutationCount = quint32(entries.size());
+    header.recordsOffset = sizeof(SnapshotHeader);
+    header.permutationsOffset = permutationsOffset;
+    header.stringsOffset = offset;
+    header.stringsLength = quint64(strings.pool().size());
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Failed to write library snapshot:" << file.errorString();
+        return false;
+    }
+
+    static const char padding[8] = {};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(records.constData()), qint64(records.size()) * sizeof(TrackRecord));
+    file.write(reinterpret_cast<const char *>(entries.constData()), qint64(entries.size()) * sizeof(PermutationEntry));
+    for (const QVector<quint32> &order : orders) {
+        const qint64 bytes = qint64(order.size()) * sizeof(quint32);
+        file.write(reinterpret_cast<const char *>(order.constData()), bytes);
+        file.write(padding, alignTo8(bytes) - bytes);
+    }
+    file.write(reinterpret_cast<const char *>(strings.pool().constData()),
+               qint64(strings.pool().size()) * sizeof(QChar));
+
+    if (!file.commit()) {
+        qWarning() << "Failed to write library snapshot:" << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool LibrarySnapshot::open(const QString &path)
+{
+    close();
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    m_size = m_file.size();
+    if (m_size < qint64(sizeof(SnapshotHeader))) {
+        close();
+        return false;
+    }
+
+    m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        qWarning() << "Failed to map library snapshot:" << m_file.errorString();
+        close();
+        return false;
+    }
+
+    // Reject anything that does not fit the file, so decoding never needs bounds checks per record
+    const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader *>(m_data);
+    const quint64 size = quint64(m_size);
+    const bool valid = std::memcmp(header->magic, SnapshotMagic, sizeof(header->magic)) == 0
+        && header->version == SnapshotVersion
+        && header->recordsOffset + quint64(header->trackCount) * sizeof(TrackRecord) <= size
+        && header->permutationsOffset + quint64(header->permutationCount) * sizeof(PermutationEntry) <= size
+        && header->stringsOffset % alignof(QChar) == 0
+        && header->stringsOffset + header->stringsLength * sizeof(QChar) <= size;
+
+    if (!valid) {
+        qDebug() << "Ignoring incompatible library snapshot" << path;
+        close();
+        return false;
+    }
+
+    const PermutationEntry *entries = reinterpret_cast<const PermutationEntry *>(m_data + header->permutationsOffset);
+    for (quint32 i = 0; i < header->permutationCount; ++i) {
+        if (entries[i].offset + quint64(header->trackCount) * sizeof(quint32) > size) {
+            qDebug() << "Ignoring truncated library snapshot" << path;
+            close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void LibrarySnapshot::close()
+{
+    if (m_data) {
+        m_file.unmap(const_cast<uchar *>(m_data));
+        m_data = nullptr;
+    }
+    m_file.close();
+    m_size = 0;
+}
+
+qint64 LibrarySnapshot::revision() const
+{
+    return m_data ? reinterpret_cast<const SnapshotHeader *>(m_data)->revision : -1;
+}
+
+int LibrarySnapshot::trackCount() const
+{
+    return m_data ? int(reinterpret_cast<const SnapshotHeader *>(m_data)->trackCount) : 0;
+}
+
+quint32 LibrarySnapshot::orderKey() const
+{
+    return m_data ? reinterpret_cast<const SnapshotHeader *>(m_data)->orderKey : 0;
+}
+
+bool LibrarySnapshot::hasOrder(quint32 orderKey) const
+{
+    return m_data && (this->orderKey() == orderKey || permutation(orderKey));
+}
+
+const quint32 *LibrarySnapshot::permutation(quint32 orderKey) const
+{
+    const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader *>(m_data);
+    const PermutationEntry *entries = reinterpret_cast<const PermutationEntry *>(m_data + header->permutationsOffset);
+
+    for (quint32 i = 0; i < header->permutationCount; ++i) {
+        if (entries[i].orderKey == orderKey) {
+            return reinterpret_cast<const quint32 *>(m_data + entries[i].offset);
+        }
+    }
+    return nullptr;
+}
+
+QString LibrarySnapshot::string(quint32 offset, quint32 length) const
+{
+    const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader *>(m_data);
+    if (quint64(offset) + length > header->stringsLength) {
+        return QString();
+    }
+    const QChar *pool = reinterpret_cast<const QChar *>(m_data + header->stringsOffset);
+    return QString(pool + offset, length);
+}
+
+MusicTrack LibrarySnapshot::decode(int row, QHash<quint32, QString> *names) const
+{
+    const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader *>(m_data);
+    const TrackRecord &record = reinterpret_cast<const TrackRecord *>(m_data + header->recordsOffset)[row];
+
+    // Directories and dimension names repeat across tracks; decode each pool entry once and share it
+    auto name = [this, names](const StringRef &ref) {
+        if (!names) {
+            return string(ref.offset, ref.length);
+        }
+        auto it = names->constFind(ref.offset);
+        if (it == names->constEnd()) {
+            it = names->insert(ref.offset, string(ref.offset, ref.length));
+        }
+        return it.value();
+    };
+
+    MusicTrack track;
+    track.id = record.id;
+    track.directoryId = record.directoryId;
+    track.filePath = name(record.directory) + '/' + string(record.fileName.offset, record.fileName.length);
+    track.title = string(record.title.offset, record.title.length);
+    track.artistId = record.artistId;
+    track.albumId = record.albumId;
+    track.genreId = record.genreId;
+    track.publisherId = record.publisherId;
+    track.artist = name(record.artist);
+    track.album = name(record.album);
+    track.genre = name(record.genre);
+    track.publisher = name(record.publisher);
+    track.catalogNumber = string(record.catalogNumber.offset, record.catalogNumber.length);
+    track.year = record.year;
+    track.track = record.track;
+    track.duration = record.duration;
+    track.fileSize = record.fileSize;
+    track.mtimeNs = record.mtimeNs;
+    track.revision = record.revision;
+    track.fieldSet = record.fieldSet;
+    track.extractorVersion = record.extractorVersion;
+    return track;
+}
+
+MusicTrack LibrarySnapshot::track(int row) const
+{
+    if (!m_data || row < 0 || row >= trackCount()) {
+        return MusicTrack();
+    }
+    return decode(row, nullptr);
+}
+
+QList<MusicTrack> LibrarySnapshot::tracks(quint32 orderKey) const
+{
+    QList<MusicTrack> result;
+    if (!m_data) {
+        return result;
+    }
+
+    const int count = trackCount();
+    const quint32 *rows = this->orderKey() == orderKey ? nullptr : permutation(orderKey);
+    QHash<quint32, QString> names;
+    result.reserve(count);
+
+    for (int i = 0; i < count; ++i) {
+        const quint32 row = rows ? rows[i] : quint32(i);
+        result.append(row < quint32(count) ? decode(int(row), &names) : MusicTrack());
+    }
+
+    return result;
+}
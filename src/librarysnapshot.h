@@ -0,0 +1,56 @@
+#ifndef LIBRARYSNAPSHOT_H
+#define LIBRARYSNAPSHOT_H
+
+#include <QFile>
+#include <QList>
+#include <QHash>
+#include <QVector>
+#include <QString>
+#include "databasemanager.h"
+
+// Binary image of the whole library for cold start. Tracks are fixed-width
+// records whose strings point into a shared, deduplicated UTF-16 pool, and
+// extra orderings are stored as row permutations. The file is memory-mapped
+// on open, so loading costs one pass over the records instead of a full
+// SELECT. The snapshot is tagged with the library revision it was written at;
+// callers compare that with DatabaseManager::currentRevision() to decide
+// whether a background refresh is needed.
+class LibrarySnapshot
+{
+public:
+    LibrarySnapshot();
+    ~LibrarySnapshot();
+
+    LibrarySnapshot(const LibrarySnapshot &) = delete;
+    LibrarySnapshot &operator=(const LibrarySnapshot &) = delete;
+
+    static QString defaultPath();
+
+    // Writes the tracks in the given order; each permutation lists record rows for another ordering
+    static bool write(const QString &path, qint64 revision, const QList<MusicTrack> &tracks,
+                      quint32 orderKey, const QHash<quint32, QVector<quint32>> &permutations = {});
+
+    bool open(const QString &path);
+    void close();
+    bool isOpen() const { return m_data != nullptr; }
+
+    qint64 revision() const;
+    int trackCount() const;
+    quint32 orderKey() const;
+    bool hasOrder(quint32 orderKey) const;
+
+    MusicTrack track(int row) const;
+    // Decodes every track in the requested order, or in record order if it is not stored
+    QList<MusicTrack> tracks(quint32 orderKey) const;
+
+private:
+    QFile m_file;
+    const uchar *m_data;
+    qint64 m_size;
+
+    const quint32 *permutation(quint32 orderKey) const;
+    QString string(quint32 offset, quint32 length) const;
+    MusicTrack decode(int row, QHash<quint32, QString> *names) const;
+};
+
+#endif // LIBRARYSNAPSHOT_H
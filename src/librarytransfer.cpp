@@ -0,0 +1,366 @@
+#include "librarytransfer.h"
+#include "trackcursor.h"
+#include <QSaveFile>
+#include <QFile>
+#include <QDir>
+#include <QDataStream>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+
+static const char JsonFormatName[] = "ongaku-library";
+
+// Binary streams start with these bytes (a big-endian quint32 as written by QDataStream)
+static const quint32 BinaryMagic = 0x4F4E474C; // "ONGL"
+static const quint32 TransferVersion = 2; // 2: extractor field set and version per track
+
+// Binary records are tagged; a directory record applies to all tracks after it
+enum BinaryTag : quint8 {
+    EndTag = 0,
+    DirectoryTag,
+    TrackTag
+};
+
+LibraryTransfer::LibraryTransfer(DatabaseManager *dbManager, QObject *parent)
+    : QObject(parent)
+    , m_dbManager(dbManager)
+    , m_processed(0)
+    , m_batchSize(1000)
+{
+}
+
+LibraryTransfer::Format LibraryTransfer::formatForPath(const QString &path)
+{
+    if (path.endsWith(".jsonl", Qt::CaseInsensitive) || path.endsWith(".json", Qt::CaseInsensitive)) {
+        return JsonLinesFormat;
+    }
+    return BinaryFormat;
+}
+
+bool LibraryTransfer::exportLibrary(const QString &path, Format format, const QString &root)
+{
+    m_processed = 0;
+    m_errorString.clear();
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return fail(file.errorString());
+    }
+
+    const int total = m_dbManager->getTrackCount();
+    const QString cleanRoot = root.isEmpty() ? QString() : QDir::cleanPath(root);
+    bool success = format == JsonLinesFormat ? writeJsonLines(&file, total, cleanRoot)
+                                             : writeBinary(&file, total, cleanRoot);
+    if (!success) {
+        file.cancelWriting();
+        return false;
+    }
+
+    if (!file.commit()) {
+        return fail(file.errorString());
+    }
+
+    qDebug() << "Exported" << m_processed << "tracks to" << path;
+    return true;
+}
+
+bool LibraryTransfer::writeJsonLines(QIODevice *device, int total, const QString &root)
+{
+    QJsonObject header;
+    header["format"] = JsonFormatName;
+    header["version"] = int(TransferVersion);
+    header["tracks"] = total;
+    header["root"] = root;
+    device->write(QJsonDocument(header).toJson(QJsonDocument::Compact) + '\n');
+
+    // Path order keeps the output stable between exports of the same library
+    TrackCursor cursor(m_dbManager, DatabaseManager::SortByFilePath, Qt::AscendingOrder, m_batchSize);
+    while (!cursor.atEnd()) {
+        const QList<MusicTrack> page = cursor.fetchNextPage();
+        if (cursor.hasError()) {
+            return fail(QString("Failed to read tracks after %1 exported: %2")
+                            .arg(m_processed).arg(cursor.errorString()));
+        }
+        for (const MusicTrack &track : page) {
+            QJsonObject object;
+            object["path"] = track.filePath;
+            object["title"] = track.title;
+            object["artist"] = track.artist;
+            object["album"] = track.album;
+            object["genre"] = track.genre;
+            object["publisher"] = track.publisher;
+            object["catalog"] = track.catalogNumber;
+            object["year"] = track.year;
+            object["track"] = track.track;
+            object["duration"] = track.duration;
+            object["size"] = track.fileSize;
+            // Nanosecond timestamps do not fit in a JSON double
+            object["mtime_ns"] = QString::number(track.mtimeNs);
+            object["field_set"] = track.fieldSet;
+            object["extractor_version"] = track.extractorVersion;
+
+            if (device->write(QJsonDocument(object).toJson(QJsonDocument::Compact) + '\n') < 0) {
+                return fail(device->errorString());
+            }
+        }
+
+        m_processed += page.size();
+        emit progress(m_processed, total);
+    }
+
+    return true;
+}
+
+bool LibraryTransfer::writeBinary(QIODevice *device, int total, const QString &root)
+{
+    QDataStream stream(device);
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream << BinaryMagic << TransferVersion << qint32(total) << root.toUtf8();
+
+    // Tracks arrive grouped by directory, so each directory is written once
+    QString currentDirectory;
+    bool haveDirectory = false;
+
+    TrackCursor cursor(m_dbManager, DatabaseManager::SortByFilePath, Qt::AscendingOrder, m_batchSize);
+    while (!cursor.atEnd()) {
+        const QList<MusicTrack> page = cursor.fetchNextPage();
+        if (cursor.hasError()) {
+            return fail(QString("Failed to read tracks after %1 exported: %2")
+                            .arg(m_processed).arg(cursor.errorString()));
+        }
+        for (const MusicTrack &track : page) {
+            const int slash = track.filePath.lastIndexOf('/');
+            const QString directory = slash >= 0 ? track.filePath.left(slash) : QString();
+            if (!haveDirectory || directory != currentDirectory) {
+                stream << quint8(DirectoryTag) << directory.toUtf8();
+                currentDirectory = directory;
+                haveDirectory = true;
+            }
+
+            stream << quint8(TrackTag)
+                   << track.filePath.mid(slash + 1).toUtf8()
+                   << track.title.toUtf8() << track.artist.toUtf8() << track.album.toUtf8()
+                   << track.genre.toUtf8() << track.publisher.toUtf8() << track.catalogNumber.toUtf8()
+                   << qint32(track.year) << qint32(track.track) << qint32(track.duration)
+                   << qint64(track.fileSize) << qint64(track.mtimeNs)
+                   << qint32(track.fieldSet) << qint32(track.extractorVersion);
+        }
+
+        if (stream.status() != QDataStream::Ok) {
+            return fail(device->errorString());
+        }
+
+        m_processed += page.size();
+        emit progress(m_processed, total);
+    }
+
+    stream << quint8(EndTag);
+    return stream.status() == QDataStream::Ok || fail(device->errorString());
+}
+
+bool LibraryTransfer::importLibrary(const QString &path, const QString &toRoot, const QString &fromRoot)
+{
+    m_processed = 0;
+    m_errorString.clear();
+    m_fromRoot = fromRoot.isEmpty() ? QString() : QDir::cleanPath(fromRoot);
+    m_toRoot = toRoot.isEmpty() ? QString() : QDir::cleanPath(toRoot);
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return fail(file.errorString());
+    }
+
+    QDataStream probe(file.peek(sizeof(quint32)));
+    quint32 magic = 0;
+    probe >> magic;
+
+    bool success = magic == BinaryMagic ? readBinary(&file) : readJsonLines(&file);
+    if (success) {
+        qDebug() << "Imported" << m_processed << "tracks from" << path;
+    }
+    return success;
+}
+
+bool LibraryTransfer::readJsonLines(QIODevice *device)
+{
+    QJsonParseError error;
+    const QJsonObject header = QJsonDocument::fromJson(device->readLine(), &error).object();
+    if (error.error != QJsonParseError::NoError || header["format"].toString() != JsonFormatName) {
+        return fail("Not a library export file");
+    }
+    if (header["version"].toInt() > int(TransferVersion)) {
+        return fail("Library export was written by a newer version");
+    }
+
+    setRecordedRoot(header["root"].toString());
+    const int total = header["tracks"].toInt();
+    QList<MusicTrack> batch;
+    batch.reserve(m_batchSize);
+    int lineNumber = 1;
+
+    while (!device->atEnd()) {
+        const QByteArray line = device->readLine();
+        ++lineNumber;
+        if (line.trimmed().isEmpty()) {
+            continue;
+        }
+
+        const QJsonObject object = QJsonDocument::fromJson(line, &error).object();
+        if (error.error != QJsonParseError::NoError) {
+            return fail(QString("Line %1: %2").arg(lineNumber).arg(error.errorString()));
+        }
+
+        MusicTrack track;
+        track.filePath = remapPath(object["path"].toString());
+        track.title = object["title"].toString();
+        track.artist = object["artist"].toString();
+        track.album = object["album"].toString();
+        track.genre = object["genre"].toString();
+        track.publisher = object["publisher"].toString();
+        track.catalogNumber = object["catalog"].toString();
+        track.year = object["year"].toInt();
+        track.track = object["track"].toInt();
+        track.duration = object["duration"].toInt();
+        track.fileSize = object["size"].toInteger();
+        track.mtimeNs = object["mtime_ns"].toString().toLongLong();
+        // Missing in version 1 files; version 0 marks the row for re-extraction
+        track.fieldSet = object["field_set"].toInt();
+        track.extractorVersion = object["extractor_version"].toInt();
+
+        if (track.filePath.isEmpty()) {
+            return fail(QString("Line %1: missing path").arg(lineNumber));
+        }
+
+        batch.append(track);
+        if (batch.size() >= m_batchSize && !flushBatch(batch, total)) {
+            return false;
+        }
+    }
+
+    return flushBatch(batch, total);
+}
+
+bool LibraryTransfer::readBinary(QIODevice *device)
+{
+    QDataStream stream(device);
+    stream.setVersion(QDataStream::Qt_6_0);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    qint32 total = 0;
+    stream >> magic >> version;
+    if (version > TransferVersion) {
+        return fail("Library export was written by a newer version");
+    }
+
+    QByteArray root;
+    stream >> total >> root;
+    setRecordedRoot(QString::fromUtf8(root));
+
+    QList<MusicTrack> batch;
+    batch.reserve(m_batchSize);
+    QString directory;
+
+    for (;;) {
+        quint8 tag = EndTag;
+        stream >> tag;
+        if (stream.status() != QDataStream::Ok) {
+            return fail("Library export is truncated");
+        }
+
+        if (tag == EndTag) {
+            break;
+        }
+
+        if (tag == DirectoryTag) {
+            QByteArray name;
+            stream >> name;
+            directory = remapPath(QString::fromUtf8(name));
+            continue;
+        }
+
+        if (tag != TrackTag) {
+            return fail(QString("Unknown record type %1").arg(tag));
+        }
+
+        QByteArray fileName, title, artist, album, genre, publisher, catalogNumber;
+        qint32 year = 0, trackNumber = 0, duration = 0;
+        qint64 fileSize = 0, mtimeNs = 0;
+        stream >> fileName >> title >> artist >> album >> genre >> publisher >> catalogNumber
+               >> year >> trackNumber >> duration >> fileSize >> mtimeNs;
+
+        qint32 fieldSet = 0, extractorVersion = 0;
+        if (version >= 2) {
+            stream >> fieldSet >> extractorVersion;
+        }
+
+        MusicTrack track;
+        track.filePath = directory + '/' + QString::fromUtf8(fileName);
+        track.title = QString::fromUtf8(title);
+        track.artist = QString::fromUtf8(artist);
+        track.album = QString::fromUtf8(album);
+        track.genre = QString::fromUtf8(genre);
+        track.publisher = QString::fromUtf8(publisher);
+        track.catalogNumber = QString::fromUtf8(catalogNumber);
+        track.year = year;
+        track.track = trackNumber;
+        track.duration = duration;
+        track.fileSize = fileSize;
+        track.mtimeNs = mtimeNs;
+        track.fieldSet = fieldSet;
+        track.extractorVersion = extractorVersion;
+
+        batch.append(track);
+        if (batch.size() >= m_batchSize && !flushBatch(batch, total)) {
+            return false;
+        }
+    }
+
+    return flushBatch(batch, total);
+}
+
+bool LibraryTransfer::flushBatch(QList<MusicTrack> &batch, int total)
+{
+    if (batch.isEmpty()) {
+        return true;
+    }
+
+    if (!m_dbManager->importTracks(batch)) {
+        return fail(QString("Failed to write tracks after %1 imported").arg(m_processed));
+    }
+
+    m_processed += batch.size();
+    batch.clear();
+    emit progress(m_processed, total);
+    return true;
+}
+
+void LibraryTransfer::setRecordedRoot(const QString &root)
+{
+    // An explicit fromRoot wins over the root stored in the file
+    if (m_fromRoot.isEmpty() && !root.isEmpty()) {
+        m_fromRoot = QDir::cleanPath(root);
+    }
+}
+
+QString LibraryTransfer::remapPath(const QString &path) const
+{
+    if (m_fromRoot.isEmpty() || m_toRoot.isEmpty() || m_fromRoot == m_toRoot) {
+        return path;
+    }
+
+    if (path == m_fromRoot) {
+        return m_toRoot;
+    }
+    if (path.startsWith(m_fromRoot) && path.at(m_fromRoot.size()) == '/') {
+        return m_toRoot + path.mid(m_fromRoot.size());
+    }
+    return path;
+}
+
+bool LibraryTransfer::fail(const QString &error)
+{
+    m_errorString = error;
+    qWarning() << "Library transfer failed:" << error;
+    return false;
+}
@@ -0,0 +1,66 @@
+#ifndef LIBRARYTRANSFER_H
+#define LIBRARYTRANSFER_H
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include "databasemanager.h"
+
+class QIODevice;
+
+// Streams the tracks table to and from a portable file so a library can be
+// moved to another machine without rescanning. Export walks the table with
+// a TrackCursor and import upserts fixed-size batches, so memory use does not
+// grow with the library. Stored sizes and mtimes are kept, which lets the next
+// scan skip every file that has not changed since the export.
+//
+// Two formats are supported: JSON lines (one header object, then one object
+// per track) and a compact binary stream that writes each directory once.
+// Import detects the format from the file contents.
+class LibraryTransfer : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Format {
+        JsonLinesFormat = 0,
+        BinaryFormat
+    };
+
+    explicit LibraryTransfer(DatabaseManager *dbManager, QObject *parent = nullptr);
+
+    // Picks JSON lines for *.jsonl / *.json and the binary format otherwise
+    static Format formatForPath(const QString &path);
+
+    // root is recorded in the file as the music directory the paths were scanned from
+    bool exportLibrary(const QString &path, Format format, const QString &root = QString());
+    // Paths under fromRoot (by default the recorded root) are rewritten to live
+    // under toRoot; other paths are imported unchanged
+    bool importLibrary(const QString &path, const QString &toRoot = QString(),
+                       const QString &fromRoot = QString());
+
+    int processedTracks() const { return m_processed; }
+    QString errorString() const { return m_errorString; }
+
+signals:
+    void progress(int processed, int total);
+
+private:
+    DatabaseManager *m_dbManager;
+    QString m_fromRoot;
+    QString m_toRoot;
+    QString m_errorString;
+    int m_processed;
+    int m_batchSize;
+
+    bool writeJsonLines(QIODevice *device, int total, const QString &root);
+    bool writeBinary(QIODevice *device, int total, const QString &root);
+    bool readJsonLines(QIODevice *device);
+    bool readBinary(QIODevice *device);
+    bool flushBatch(QList<MusicTrack> &batch, int total);
+    void setRecordedRoot(const QString &root);
+    QString remapPath(const QString &path) const;
+    bool fail(const QString &error);
+};
+
+#endif // LIBRARYTRANSFER_H
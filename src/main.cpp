@@ -1,5 +1,7 @@
 #include <QApplication>
+#include <QTimer>
 #include "mainwindow.h"
+#include "databasemanager.h"
 
 int main(int argc, char *argv[])
 {
@@ -9,8 +11,32 @@ int main(int argc, char *argv[])
     app.setApplicationVersion("1.0.0");
     app.setOrganizationName("Ongaku");
 
+    // Compare row decoding throughput on the current library and exit
+    if (app.arguments().contains("--benchmark-decoding")) {
+        DatabaseManager dbManager;
+        if (!dbManager.initialize()) {
+            return 1;
+        }
+        dbManager.benchmarkRowDecoding();
+        return 0;
+    }
+
+    // Fail with a non-zero exit code if a hot query lost its index
+    if (app.arguments().contains("--check-query-plans")) {
+        DatabaseManager dbManager;
+        if (!dbManager.initialize()) {
+            return 1;
+        }
+        return dbManager.checkQueryPlans() ? 0 : 1;
+    }
+
     MainWindow window;
     window.show();
 
+    // Measure search keystroke-to-paint latency on the current library and exit
+    if (app.arguments().contains("--benchmark-search")) {
+        QTimer::singleShot(0, &window, &MainWindow::runSearchBenchmark);
+    }
+
     return app.exec();
 }
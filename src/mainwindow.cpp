@@ -1,12 +1,19 @@
 #include "mainwindow.h"
+#include "librarysnapshot.h"
+#include "librarytransfer.h"
 #include <QApplication>
 #include <QMessageBox>
+#include <QFileDialog>
+#include <QInputDialog>
+#include <QProgressDialog>
 #include <QHeaderView>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QFileInfo>
 #include <QUrl>
 #include <QDir>
 #include <QTableView>
+#include <algorithm>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -22,9 +29,13 @@ MainWindow::MainWindow(QWidget *parent)
     , m_viewCombo(nullptr)
     , m_scanButton(nullptr)
     , m_databaseManager(new DatabaseManager(this))
+    , m_queryRunner(new AsyncQueryRunner(m_databaseManager, this))
+    , m_playStatistics(new PlayStatistics(m_databaseManager, this))
     , m_musicScanner(new MusicScanner(m_databaseManager, this))
-    , m_libraryModel(new MusicLibraryModel(m_databaseManager, this))
-    , m_flatModel(new MusicLibraryFlatModel(m_databaseManager, this))
+    , m_trackStore(new TrackStore(m_databaseManager, this))
+    , m_searchIndex(new SearchIndex(m_trackStore, this))
+    , m_libraryModel(new MusicLibraryModel(m_databaseManager, m_trackStore, this))
+    , m_flatModel(new MusicLibraryFlatModel(m_databaseManager, m_trackStore, this))
     , m_musicPlayer(new MusicPlayer(this))
     , m_scanInProgress(false)
     , m_pendingViewUpdate(false)
@@ -40,16 +51,28 @@ MainWindow::MainWindow(QWidget *parent)
         QMessageBox::critical(this, "Database Error", "Failed to initialize database.");
         return;
     }
+    m_queryRunner->start();
+    m_databaseManager->startMaintenance();
+    m_playStatistics->load();
+    m_flatModel->setStatistics(m_playStatistics);
+    m_flatModel->setSearchIndex(m_searchIndex);
+    m_libraryModel->setSearchIndex(m_searchIndex);
 
-    // Load existing library
-    m_libraryModel->refreshData();
-    m_flatModel->refreshData();
+    // Load existing library; both models rebuild from the shared store
+    loadLibrary();
 
     m_statusLabel->setText("Ready");
 }
 
 MainWindow::~MainWindow()
 {
+    // A running scan holds the write transaction, which the flush below cannot
+    // share. Stop it first so its batch commits, without updating torn-down views.
+    m_musicScanner->disconnect(this);
+    m_musicScanner->stopScanning();
+
+    // Write buffered plays while the database is still open
+    m_playStatistics->flush();
 }
 
 void MainWindow::setupUI()
@@ -159,6 +182,9 @@ void MainWindow::setupUI()
     tableHeader->resizeSection(MusicLibraryFlatModel::YearColumn, 60);
     tableHeader->resizeSection(MusicLibraryFlatModel::TrackColumn, 60);
     tableHeader->resizeSection(MusicLibraryFlatModel::DurationColumn, 80);
+    tableHeader->resizeSection(MusicLibraryFlatModel::PlayCountColumn, 60);
+    tableHeader->resizeSection(MusicLibraryFlatModel::LastPlayedColumn, 130);
+    tableHeader->resizeSection(MusicLibraryFlatModel::SkipCountColumn, 60);
     tableHeader->setSectionResizeMode(MusicLibraryFlatModel::TitleColumn, QHeaderView::Stretch);
 
     // Add views to stacked widget
@@ -177,7 +203,7 @@ void MainWindow::setupUI()
     mainLayout->addWidget(verticalSplitter);
 
     // Expand first level by default
-    m_libraryView->expandToDepth(0);
+    expandLibraryView();
 }
 
 void MainWindow::setupMenuBar()
@@ -197,6 +223,20 @@ void MainWindow::setupMenuBar()
     m_refreshAction->setStatusTip("Refresh the library view");
     fileMenu->addAction(m_refreshAction);
 
+    m_reextractAction = new QAction("Re-extract &Stale Tags", this);
+    m_reextractAction->setStatusTip("Reread tags only for files read by an older version of the tag reader");
+    fileMenu->addAction(m_reextractAction);
+
+    fileMenu->addSeparator();
+
+    m_exportAction = new QAction("&Export Library...", this);
+    m_exportAction->setStatusTip("Save the library database to a portable file");
+    fileMenu->addAction(m_exportAction);
+
+    m_importAction = new QAction("&Import Library...", this);
+    m_importAction->setStatusTip("Load a library exported on another machine without rescanning");
+    fileMenu->addAction(m_importAction);
+
     fileMenu->addSeparator();
 
     m_exitAction = new QAction("E&xit", this);
@@ -232,22 +272,12 @@ void MainWindow::connectSignals()
     // Search functionality
     connect(m_searchEdit, &QLineEdit::textChanged, this, &MainWindow::onSearchTextChanged);
 
-    // Set search timer to single shot and give enough delay for user to finish typing
+    // Set search timer to single shot; once the in-memory index is built a search
+    // takes well under a frame, so the delay only coalesces keystrokes
     m_searchTimer->setSingleShot(true);
-    m_searchTimer->setInterval(500); // 500ms delay after user stops typing
-
-    connect(m_searchTimer, &QTimer::timeout, [this]() {
-        QString searchText = m_searchEdit->text().trimmed();
-        qDebug() << "Search timer triggered with text:" << searchText;
-        if (searchText.isEmpty()) {
-            m_libraryModel->showAllTracks();
-            m_flatModel->showAllTracks();
-        } else {
-            m_libraryModel->searchTracks(searchText);
-            m_flatModel->searchTracks(searchText);
-        }
-        m_libraryView->expandToDepth(0);
-    });
+    m_searchTimer->setInterval(50); // 50ms delay after user stops typing
+
+    connect(m_searchTimer, &QTimer::timeout, this, &MainWindow::runSearch);
 
     // View update timer for scanning (set interval and single shot)
     m_viewUpdateTimer->setSingleShot(false);
@@ -269,6 +299,13 @@ void MainWindow::connectSignals()
     // Menu actions
     connect(m_scanAction, &QAction::triggered, this, [this]() { onScanLibrary(); });
     connect(m_refreshAction, &QAction::triggered, this, [this]() { onRefreshLibrary(); });
+    connect(m_reextractAction, &QAction::triggered, this, [this]() {
+        if (!m_scanInProgress) {
+            m_musicScanner->reextractStale();
+        }
+    });
+    connect(m_exportAction, &QAction::triggered, this, [this]() { onExportLibrary(); });
+    connect(m_importAction, &QAction::triggered, this, [this]() { onImportLibrary(); });
     connect(m_exitAction, &QAction::triggered, this, [this]() { close(); });
     connect(m_aboutAction, &QAction::triggered, this, [this]() { onAbout(); });
 
@@ -281,9 +318,15 @@ void MainWindow::connectSignals()
     connect(m_musicScanner, &MusicScanner::scanCompleted, this, &MainWindow::onScanCompleted);
     connect(m_musicScanner, &MusicScanner::scanError, this, &MainWindow::onScanError);
 
+    // Play statistics are buffered in memory and written in batches
+    connect(m_musicPlayer, &MusicPlayer::trackChanged, m_playStatistics, &PlayStatistics::recordPlay);
+    connect(m_musicPlayer, &MusicPlayer::trackSkipped, m_playStatistics, &PlayStatistics::recordSkip);
+
     // Library view signals
     connect(m_libraryView, &QTreeView::doubleClicked, this, &MainWindow::onLibraryDoubleClicked);
     connect(m_flatView, &QTableView::doubleClicked, this, &MainWindow::onLibraryDoubleClicked);
+    // Trees are built in the background, so expand them once they arrive
+    connect(m_libraryModel, &MusicLibraryModel::treeReplaced, this, &MainWindow::expandLibraryView);
 }
 
 void MainWindow::onSearchTextChanged()
@@ -294,6 +337,94 @@ void MainWindow::onSearchTextChanged()
     m_searchTimer->start();
 }
 
+void MainWindow::runSearch()
+{
+    QString searchText = m_searchEdit->text().trimmed();
+    qDebug() << "Search timer triggered with text:" << searchText;
+    if (searchText.isEmpty()) {
+        m_queryRunner->cancel();
+        m_libraryModel->showAllTracks();
+        m_flatModel->showAllTracks();
+        expandLibraryView();
+
+        // The restored tree is collapsed; open the branch of the track kept current
+        const QModelIndex current = m_libraryView->currentIndex();
+        if (current.isValid()) {
+            m_libraryView->scrollTo(current);
+        }
+        return;
+    }
+
+    if (m_searchIndex->isReady()) {
+        m_queryRunner->cancel();
+        const QVector<int> rows = m_searchIndex->search(searchText);
+        m_libraryModel->setSearchRows(searchText, rows);
+        m_flatModel->setSearchRows(searchText, rows);
+        expandLibraryView();
+        return;
+    }
+
+    // The index is still being built; ask the database off the GUI thread
+    m_queryRunner->searchTracks(searchText, [this, searchText](const QList<MusicTrack> &tracks) {
+        m_libraryModel->setSearchResults(searchText, tracks);
+        m_flatModel->setSearchResults(searchText, tracks);
+        expandLibraryView();
+    });
+}
+
+void MainWindow::runSearchBenchmark()
+{
+    if (!m_searchIndex->isReady()) {
+        connect(m_searchIndex, &SearchIndex::ready, this, &MainWindow::runSearchBenchmark, Qt::SingleShotConnection);
+        return;
+    }
+
+    // Type a few artist names one character at a time, then delete them again
+    QStringList keystrokes;
+    const QVector<int> rows = m_trackStore->allRows();
+    const int names = qMin(5, int(rows.size()));
+    for (int i = 0; i < names; ++i) {
+        const QString name = m_trackStore->artist(rows.at(rows.size() * i / names)).left(12);
+        for (int length = 1; length <= name.size(); ++length) {
+            keystrokes << name.left(length);
+        }
+        for (int length = name.size() - 1; length >= 0; --length) {
+            keystrokes << name.left(length);
+        }
+    }
+
+    if (keystrokes.isEmpty()) {
+        qDebug() << "Search benchmark needs a non-empty library";
+        QApplication::quit();
+        return;
+    }
+
+    // The debounce is skipped: each sample is search, model update and a synchronous repaint
+    for (bool diffed : {true, false}) {
+        m_libraryModel->setSearchDiffLimit(diffed ? MusicLibraryModel::DefaultSearchDiffLimit : 0);
+        m_flatModel->setSearchDiffLimit(diffed ? MusicLibraryFlatModel::DefaultSearchDiffLimit : 0);
+
+        QVector<qint64> latencies;
+        QElapsedTimer timer;
+        for (const QString &text : std::as_const(keystrokes)) {
+            timer.start();
+            m_searchEdit->setText(text);
+            m_searchTimer->stop();
+            runSearch();
+            m_libraryView->viewport()->repaint();
+            m_flatView->viewport()->repaint();
+            latencies.append(timer.nsecsElapsed() / 1000);
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+        qDebug() << (diffed ? "Diffed results:" : "Reset results:") << latencies.size() << "keystrokes, median"
+                 << latencies.at(latencies.size() / 2) << "us, 95th percentile"
+                 << latencies.at(latencies.size() * 95 / 100) << "us, max" << latencies.last() << "us";
+    }
+
+    QApplication::quit();
+}
+
 void MainWindow::onSortModeChanged()
 {
     MusicLibraryModel::SortMode mode = static_cast<MusicLibraryModel::SortMode>(
@@ -306,7 +437,7 @@ void MainWindow::onSortModeChanged()
     m_libraryView->header()->setSectionsClickable(false);
     m_libraryView->header()->setSortIndicatorShown(false);
 
-    m_libraryView->expandToDepth(0);
+    expandLibraryView();
 
     // Note: Flat view uses column-based sorting, so no need to apply sort mode there
 }
@@ -320,7 +451,7 @@ void MainWindow::onViewModeChanged()
         // Tree view - enable/disable sort combo based on tree view
         m_sortCombo->setEnabled(true);
         // Ensure tree view is expanded
-        m_libraryView->expandToDepth(0);
+        expandLibraryView();
     } else {
         // Flat view - disable tree-specific sort combo since flat view has column sorting
         m_sortCombo->setEnabled(false);
@@ -348,6 +479,7 @@ void MainWindow::onScanLibrary()
 void MainWindow::onScanStarted()
 {
     m_scanInProgress = true;
+    m_databaseManager->setMaintenancePaused(true);
     m_pendingViewUpdate = false;
     m_scanButton->setText("Stop Scan");
     m_progressBar->setVisible(true);
@@ -358,6 +490,7 @@ void MainWindow::onScanStarted()
     // Disable other actions during scan
     m_refreshButton->setEnabled(false);
     m_scanAction->setText("Stop Scan");
+    m_reextractAction->setEnabled(false);
 }
 
 void MainWindow::onScanProgress(int current, int total)
@@ -406,6 +539,7 @@ void MainWindow::onTrackUpdated(const MusicTrack &track)
 void MainWindow::onScanCompleted(int tracksFound, int tracksAdded, int tracksUpdated)
 {
     m_scanInProgress = false;
+    m_databaseManager->setMaintenancePaused(false);
     m_pendingViewUpdate = false;
     m_viewUpdateTimer->stop();
     m_scanButton->setText("Scan Library");
@@ -418,11 +552,11 @@ void MainWindow::onScanCompleted(int tracksFound, int tracksAdded, int tracksUpd
     // Re-enable controls
     m_refreshButton->setEnabled(true);
     m_scanAction->setText("Scan Library");
+    m_reextractAction->setEnabled(true);
 
-    // Final refresh of both models
-    m_libraryModel->refreshData();
-    m_flatModel->refreshData();
-    m_libraryView->expandToDepth(0);
+    // Apply what the scan wrote since the last tick; both views keep their state
+    m_trackStore->updateFromDatabase();
+    saveLibrarySnapshot();
     updateStatusBar();
 
     // Show completion message if significant changes
@@ -434,12 +568,14 @@ void MainWindow::onScanCompleted(int tracksFound, int tracksAdded, int tracksUpd
 void MainWindow::onScanError(const QString &error)
 {
     m_scanInProgress = false;
+    m_databaseManager->setMaintenancePaused(false);
     m_pendingViewUpdate = false;
     m_viewUpdateTimer->stop();
     m_scanButton->setText("Scan Library");
     m_progressBar->setVisible(false);
     m_refreshButton->setEnabled(true);
     m_scanAction->setText("Scan Library");
+    m_reextractAction->setEnabled(true);
 
     m_statusLabel->setText("Scan failed");
     QMessageBox::critical(this, "Scan Error", "Failed to scan music library:\n" + error);
@@ -497,13 +633,118 @@ void MainWindow::onLibraryDoubleClicked(const QModelIndex &index)
 
 void MainWindow::onRefreshLibrary()
 {
-    m_libraryModel->refreshData();
-    m_flatModel->refreshData();
-    m_libraryView->expandToDepth(0);
+    m_trackStore->reload();
+    saveLibrarySnapshot();
+    expandLibraryView();
     updateStatusBar();
     m_statusLabel->setText("Library refreshed");
 }
 
+void MainWindow::onExportLibrary()
+{
+    QString path = QFileDialog::getSaveFileName(this, "Export Library", QDir::homePath() + "/library.ongaku",
+                                                "Ongaku library (*.ongaku);;JSON lines (*.jsonl)");
+    if (path.isEmpty()) {
+        return;
+    }
+
+    LibraryTransfer transfer(m_databaseManager);
+    QProgressDialog progress("Exporting library...", QString(), 0, 0, this);
+    progress.setWindowModality(Qt::WindowModal);
+    progress.setMinimumDuration(500);
+    connect(&transfer, &LibraryTransfer::progress, &progress, [&progress](int processed, int total) {
+        progress.setMaximum(total);
+        progress.setValue(processed);
+    });
+
+    if (!transfer.exportLibrary(path, LibraryTransfer::formatForPath(path), m_musicScanner->musicDirectory())) {
+        QMessageBox::warning(this, "Export Failed", transfer.errorString());
+        return;
+    }
+
+    m_statusLabel->setText(QString("Exported %1 tracks").arg(transfer.processedTracks()));
+}
+
+void MainWindow::onImportLibrary()
+{
+    if (m_scanInProgress) {
+        QMessageBox::information(this, "Scan In Progress", "Wait for the current scan to finish before importing.");
+        return;
+    }
+
+    QString path = QFileDialog::getOpenFileName(this, "Import Library", QDir::homePath(),
+                                                "Ongaku library (*.ongaku *.jsonl);;All files (*)");
+    if (path.isEmpty()) {
+        return;
+    }
+
+    // Paths under the exporting machine's music folder are moved to this one
+    bool ok = false;
+    QString musicRoot = QInputDialog::getText(this, "Import Library", "Music folder on this machine:",
+                                              QLineEdit::Normal, m_musicScanner->musicDirectory(), &ok);
+    if (!ok) {
+        return;
+    }
+
+    LibraryTransfer transfer(m_databaseManager);
+    QProgressDialog progress("Importing library...", QString(), 0, 0, this);
+    progress.setWindowModality(Qt::WindowModal);
+    progress.setMinimumDuration(500);
+    connect(&transfer, &LibraryTransfer::progress, &progress, [&progress](int processed, int total) {
+        progress.setMaximum(qMax(total, processed));
+        progress.setValue(processed);
+    });
+
+    m_databaseManager->setMaintenancePaused(true);
+    bool success = transfer.importLibrary(path, musicRoot.trimmed());
+    m_databaseManager->setMaintenancePaused(false);
+    progress.reset();
+
+    if (transfer.processedTracks() > 0) {
+        onRefreshLibrary();
+    }
+
+    if (!success) {
+        QMessageBox::warning(this, "Import Failed", transfer.errorString());
+        return;
+    }
+
+    m_statusLabel->setText(QString("Imported %1 tracks").arg(transfer.processedTracks()));
+}
+
+void MainWindow::loadLibrary()
+{
+    LibrarySnapshot snapshot;
+    if (!snapshot.open(LibrarySnapshot::defaultPath()) || !m_flatModel->loadSnapshot(snapshot)) {
+        m_trackStore->reload();
+        saveLibrarySnapshot();
+        return;
+    }
+
+    const qint64 revision = m_databaseManager->currentRevision();
+    if (snapshot.revision() == revision) {
+        qDebug() << "Loaded" << snapshot.trackCount() << "tracks from library snapshot";
+        return;
+    }
+
+    // Show the stale snapshot right away and reload from the database off the GUI thread
+    qDebug() << "Library snapshot is at revision" << snapshot.revision() << "but the database is at"
+             << revision << "- refreshing in the background";
+    m_queryRunner->run([](DatabaseManager *readDb) {
+        return readDb->getAllTracks();
+    }, [this, revision](const QList<MusicTrack> &tracks) {
+        // The worker read at least this revision; anything newer is reapplied by updateFromDatabase()
+        m_trackStore->setTracks(tracks, revision);
+        saveLibrarySnapshot();
+        updateStatusBar();
+    });
+}
+
+void MainWindow::saveLibrarySnapshot()
+{
+    m_flatModel->saveSnapshot(LibrarySnapshot::defaultPath(), m_databaseManager->currentRevision());
+}
+
 void MainWindow::onAbout()
 {
     QMessageBox::about(this, "About Ongaku",
@@ -527,13 +768,20 @@ void MainWindow::updateStatusBar()
     m_trackCountLabel->setText(QString("%1 tracks in library").arg(trackCount));
 }
 
+void MainWindow::expandLibraryView()
+{
+    // Expanding every group would fetch all of its children, so lazily
+    // populated trees are left for the user to open on demand
+    if (!m_libraryModel->populatesLazily()) {
+        m_libraryView->expandToDepth(0);
+    }
+}
+
 void MainWindow::onUpdateViewDuringScanning()
 {
     if (m_scanInProgress && m_pendingViewUpdate) {
-        // Refresh both models to show new tracks
-        m_libraryModel->refreshData();
-        m_flatModel->refreshData();
-        m_libraryView->expandToDepth(0);
+        // New and rescanned tracks go into both views in place
+        m_trackStore->updateFromDatabase();
         m_pendingViewUpdate = false;
 
         // Update the status bar to show current track count
@@ -23,6 +23,10 @@
 #include "musiclibrarymodel.h"
 #include "musiclibraryflat.h"
 #include "musicplayer.h"
+#include "asyncqueryrunner.h"
+#include "playstatistics.h"
+#include "trackstore.h"
+#include "searchindex.h"
 
 class MainWindow : public QMainWindow
 {
@@ -32,8 +36,13 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+    // Types library names into the search box once the search index is ready,
+    // logs keystroke-to-paint latency with diffed and with reset results, then quits
+    void runSearchBenchmark();
+
 private slots:
     void onSearchTextChanged();
+    void runSearch();
     void onSortModeChanged();
     void onViewModeChanged();
     void onScanLibrary();
@@ -46,6 +55,8 @@ private slots:
     void onScanError(const QString &error);
     void onLibraryDoubleClicked(const QModelIndex &index);
     void onRefreshLibrary();
+    void onExportLibrary();
+    void onImportLibrary();
     void onAbout();
     void onUpdateViewDuringScanning();
 
@@ -55,10 +66,17 @@ private:
     void setupStatusBar();
     void connectSignals();
     void updateStatusBar();
+    void expandLibraryView();
+    void loadLibrary();
+    void saveLibrarySnapshot();
 
     // Core components
     DatabaseManager *m_databaseManager;
+    AsyncQueryRunner *m_queryRunner;
+    PlayStatistics *m_playStatistics;
     MusicScanner *m_musicScanner;
+    TrackStore *m_trackStore; // One copy of the library, shared by both models
+    SearchIndex *m_searchIndex;
     MusicLibraryModel *m_libraryModel;
     MusicLibraryFlatModel *m_flatModel;
     MusicPlayer *m_musicPlayer;
@@ -81,6 +99,9 @@ private:
     // Menu actions
     QAction *m_scanAction;
     QAction *m_refreshAction;
+    QAction *m_reextractAction;
+    QAction *m_exportAction;
+    QAction *m_importAction;
     QAction *m_exitAction;
     QAction *m_aboutAction;
 
@@ -0,0 +1,40 @@
+#include "musiclibraryarena.h"
+#include <algorithm>
+
+MusicLibraryArena::MusicLibraryArena(int capacity)
+{
+    m_blocks.emplace_back();
+    m_blocks.back().reserve(std::max(capacity, int(MinimumBlockSize)));
+}
+
+MusicLibraryItem *MusicLibraryArena::create(MusicLibraryItem::ItemType type, const QString &text,
+                                            MusicLibraryItem *parent)
+{
+    if (!m_freeItems.isEmpty()) {
+        MusicLibraryItem *item = m_freeItems.takeLast();
+        *item = MusicLibraryItem(type, text, parent);
+        return item;
+    }
+
+    // A full block is left as it is; growing it would move the items
+    std::vector<MusicLibraryItem> *block = &m_blocks.back();
+    if (block->size() == block->capacity()) {
+        const size_t size = block->capacity() * 2;
+        m_blocks.emplace_back();
+        block = &m_blocks.back();
+        block->reserve(size);
+    }
+
+    block->emplace_back(type, text, parent);
+    return &block->back();
+}
+
+void MusicLibraryArena::release(MusicLibraryItem *item)
+{
+    for (int i = 0; i < item->childCount(); ++i) {
+        release(item->child(i));
+    }
+    // Drops the child list and text now; the slot waits for reuse
+    *item = MusicLibraryItem(MusicLibraryItem::RootItem);
+    m_freeItems.append(item);
+}
@@ -0,0 +1,37 @@
+#ifndef MUSICLIBRARYARENA_H
+#define MUSICLIBRARYARENA_H
+
+#include <QString>
+#include <QVector>
+#include <vector>
+#include "musiclibrarymodel.h"
+
+// Owns every item of one library tree. Items are stored by value in large
+// blocks that never reallocate, so item pointers stay valid, a tree built
+// in one go sits in one contiguous allocation, and destroying the arena
+// frees the whole tree without visiting it node by node. Items removed by
+// incremental updates are recycled for the next create().
+//
+// Only the root and the branches fetched on expansion own a child list; a
+// build creates none below the root. Group names are implicit copies of the
+// store's interned strings, and track items have no text, so neither
+// allocates per item.
+class MusicLibraryArena
+{
+public:
+    // Room for this many items before a second block is needed
+    explicit MusicLibraryArena(int capacity = 0);
+
+    MusicLibraryItem *create(MusicLibraryItem::ItemType type, const QString &text = QString(),
+                             MusicLibraryItem *parent = nullptr);
+    // For an item already taken out of its parent; its children go with it
+    void release(MusicLibraryItem *item);
+
+private:
+    static const int MinimumBlockSize = 1024;
+
+    std::vector<std::vector<MusicLibraryItem>> m_blocks;
+    QVector<MusicLibraryItem*> m_freeItems;
+};
+
+#endif // MUSICLIBRARYARENA_H
@@ -1,22 +1,81 @@
 #include "musiclibraryflat.h"
+#include "librarysnapshot.h"
+#include "playstatistics.h"
+#include "rowdiff.h"
+#include "searchindex.h"
+#include <QScopedValueRollback>
+#include <QDateTime>
 #include <QFont>
+#include <QThread>
+#include <QtConcurrent>
 #include <QDebug>
 #include <algorithm>
+#include <numeric>
+
+// Below this many rows a single std::sort beats splitting the work
+static const int ParallelSortThreshold = 20000;
+
+// Sorts one chunk per core on the global thread pool, then merges
+// neighbouring runs pairwise, each level of merges also in parallel
+template <typename LessThan>
+static void parallelSort(QVector<int> &rows, LessThan lessThan)
+{
+    const int chunkCount = QThread::idealThreadCount();
+    if (chunkCount < 2 || rows.size() < ParallelSortThreshold) {
+        std::sort(rows.begin(), rows.end(), lessThan);
+        return;
+    }
+
+    // Run i covers [bounds[i], bounds[i + 1])
+    QVector<int> bounds(chunkCount + 1);
+    for (int i = 0; i <= chunkCount; ++i) {
+        bounds[i] = int(qint64(rows.size()) * i / chunkCount);
+    }
+
+    int *data = rows.data();
+    QVector<int> runs(chunkCount);
+    std::iota(runs.begin(), runs.end(), 0);
+    QtConcurrent::blockingMap(runs, [&](int run) {
+        std::sort(data + bounds[run], data + bounds[run + 1], lessThan);
+    });
+
+    for (int width = 1; width < chunkCount; width *= 2) {
+        QVector<int> merges;
+        for (int run = 0; run + width < chunkCount; run += 2 * width) {
+            merges.append(run);
+        }
+        QtConcurrent::blockingMap(merges, [&](int run) {
+            const int end = qMin(run + 2 * width, chunkCount);
+            std::inplace_merge(data + bounds[run], data + bounds[run + width], data + bounds[end], lessThan);
+        });
+    }
+}
 
 // MusicLibraryFlatModel implementation
-MusicLibraryFlatModel::MusicLibraryFlatModel(DatabaseManager *dbManager, QObject *parent)
+MusicLibraryFlatModel::MusicLibraryFlatModel(DatabaseManager *dbManager, TrackStore *store, QObject *parent)
     : QAbstractTableModel(parent)
     , m_dbManager(dbManager)
+    , m_store(store)
+    , m_adoptStoreOrder(false)
     , m_sortColumn(TitleColumn)
     , m_sortOrder(Qt::AscendingOrder)
+    , m_statistics(nullptr)
+    , m_searchIndex(nullptr)
+    , m_searchDiffLimit(DefaultSearchDiffLimit)
+    , m_statisticsPosition(-1)
 {
+    connect(m_store, &TrackStore::tracksReset, this, &MusicLibraryFlatModel::refreshData);
+    connect(m_store, &TrackStore::tracksAboutToChange, this, &MusicLibraryFlatModel::onTracksAboutToChange);
+    connect(m_store, &TrackStore::tracksInserted, this, &MusicLibraryFlatModel::onTracksInserted);
+    connect(m_store, &TrackStore::tracksUpdated, this, &MusicLibraryFlatModel::onTracksUpdated);
+    connect(m_store, &TrackStore::tracksRemoved, this, &MusicLibraryFlatModel::onTracksRemoved);
     refreshData();
 }
 
 int MusicLibraryFlatModel::rowCount(const QModelIndex &parent) const
 {
     Q_UNUSED(parent);
-    return m_tracks.size();
+    return m_rows.size();
 }
 
 int MusicLibraryFlatModel::columnCount(const QModelIndex &parent) const
@@ -27,33 +86,47 @@ int MusicLibraryFlatModel::columnCount(const QModelIndex &parent) const
 
 QVariant MusicLibraryFlatModel::data(const QModelIndex &index, int role) const
 {
-    if (!index.isValid() || index.row() >= m_tracks.size()) {
+    if (!index.isValid() || index.row() >= m_rows.size()) {
         return QVariant();
     }
 
-    const MusicTrack &track = m_tracks.at(index.row());
+    const int row = m_rows.at(index.row());
 
     switch (role) {
         case Qt::DisplayRole:
             switch (index.column()) {
                 case TitleColumn:
-                    return track.title;
+                    return m_store->title(row);
                 case ArtistColumn:
-                    return track.artist;
+                    return m_store->artist(row);
                 case AlbumColumn:
-                    return track.album;
+                    return m_store->album(row);
                 case GenreColumn:
-                    return track.genre;
+                    return m_store->genre(row);
                 case PublisherColumn:
-                    return track.publisher;
+                    return m_store->publisher(row);
                 case CatalogNumberColumn:
-                    return track.catalogNumber;
+                    return m_store->catalogNumber(row);
                 case YearColumn:
-                    return track.year > 0 ? QString::number(track.year) : QString();
+                    return m_store->year(row) > 0 ? QString::number(m_store->year(row)) : QString();
                 case TrackColumn:
-                    return track.track > 0 ? QString::number(track.track) : QString();
+                    return m_store->trackNumber(row) > 0 ? QString::number(m_store->trackNumber(row)) : QString();
                 case DurationColumn:
-                    return formatDuration(track.duration);
+                    return formatDuration(m_store->duration(row));
+                case PlayCountColumn: {
+                    int plays = statistics(row).playCount;
+                    return plays > 0 ? QString::number(plays) : QString();
+                }
+                case LastPlayedColumn: {
+                    qint64 lastPlayed = statistics(row).lastPlayedMs;
+                    return lastPlayed > 0
+                        ? QDateTime::fromMSecsSinceEpoch(lastPlayed).toString("yyyy-MM-dd hh:mm")
+                        : QString();
+                }
+                case SkipCountColumn: {
+                    int skips = statistics(row).skipCount;
+                    return skips > 0 ? QString::number(skips) : QString();
+                }
                 default:
                     return QVariant();
             }
@@ -61,13 +134,16 @@ QVariant MusicLibraryFlatModel::data(const QModelIndex &index, int role) const
 
         case Qt::UserRole:
             // Return the track data for easy access
-            return QVariant::fromValue(track);
+            return QVariant::fromValue(m_store->track(row));
 
         case Qt::TextAlignmentRole:
             switch (index.column()) {
                 case YearColumn:
                 case TrackColumn:
                 case DurationColumn:
+                case PlayCountColumn:
+                case LastPlayedColumn:
+                case SkipCountColumn:
                     return QVariant(Qt::AlignCenter);
                 default:
                     return QVariant(Qt::AlignLeft | Qt::AlignVCenter);
@@ -106,6 +182,12 @@ QVariant MusicLibraryFlatModel::headerData(int section, Qt::Orientation orientat
                     return "Track";
                 case DurationColumn:
                     return "Duration";
+                case PlayCountColumn:
+                    return "Plays";
+                case LastPlayedColumn:
+                    return "Last Played";
+                case SkipCountColumn:
+                    return "Skips";
                 default:
                     return QVariant();
             }
@@ -146,40 +228,118 @@ void MusicLibraryFlatModel::sort(int column, Qt::SortOrder order)
         return;
     }
 
-    beginResetModel();
+    if (column == m_sortColumn && order == m_sortOrder) {
+        return;
+    }
+
+    // Keep the order being left, so switching back is a copy
+    if (!m_sortedRows.contains(m_sortColumn)) {
+        QVector<int> ascending = m_rows;
+        if (m_sortOrder == Qt::DescendingOrder) {
+            std::reverse(ascending.begin(), ascending.end());
+        }
+        m_sortedRows.insert(m_sortColumn, ascending);
+    }
+
     m_sortColumn = column;
     m_sortOrder = order;
-    sortTracks();
-    endResetModel();
+    setRowOrder(sortedOrder());
+}
+
+void MusicLibraryFlatModel::setRowOrder(const QVector<int> &rows)
+{
+    // A layout change rather than a reset keeps the selection and current index
+    emit layoutAboutToBeChanged({}, QAbstractItemModel::VerticalSortHint);
+    const QModelIndexList persistent = persistentIndexList();
+    QVector<int> persistentRows;
+    persistentRows.reserve(persistent.size());
+    for (const QModelIndex &index : persistent) {
+        persistentRows.append(m_rows.value(index.row(), -1));
+    }
+
+    m_rows = rows;
+
+    if (!persistent.isEmpty()) {
+        QVector<int> positions(m_store->size(), -1);
+        for (int i = 0; i < m_rows.size(); ++i) {
+            positions[m_rows.at(i)] = i;
+        }
+
+        QModelIndexList moved;
+        moved.reserve(persistent.size());
+        for (int i = 0; i < persistent.size(); ++i) {
+            const int row = persistentRows.at(i);
+            moved.append(row >= 0 ? index(positions.at(row), persistent.at(i).column()) : QModelIndex());
+        }
+        changePersistentIndexList(persistent, moved);
+    }
+    emit layoutChanged({}, QAbstractItemModel::VerticalSortHint);
 }
 
 void MusicLibraryFlatModel::refreshData()
 {
     beginResetModel();
+    invalidateSortCache();
 
     if (m_currentSearchTerm.isEmpty()) {
-        m_tracks = m_dbManager->getAllTracks();
+        m_rows = m_store->allRows();
     } else {
-        m_tracks = m_dbManager->searchTracks(m_currentSearchTerm);
+        m_rows = searchRows(m_currentSearchTerm);
     }
 
-    sortTracks();
+    // Adopted rows are not sorted here, but later binary searches compare keys
+    prepareSortKeys();
+    if (!m_adoptStoreOrder) {
+        m_rows = sortedOrder();
+    }
     endResetModel();
 }
 
 void MusicLibraryFlatModel::searchTracks(const QString &searchTerm)
 {
-    beginResetModel();
+    // Clearing the search is the most common keystroke, so it goes through
+    // the same diff as any other instead of a reset
+    const QString term = searchTerm.trimmed();
+    setSearchRows(term, term.isEmpty() ? m_store->allRows() : searchRows(term));
+}
+
+void MusicLibraryFlatModel::setSearchResults(const QString &searchTerm, const QList<MusicTrack> &tracks)
+{
+    setSearchRows(searchTerm, m_store->rowsFor(tracks));
+}
+
+void MusicLibraryFlatModel::setSearchRows(const QString &searchTerm, const QVector<int> &rows)
+{
     m_currentSearchTerm = searchTerm.trimmed();
 
-    if (m_currentSearchTerm.isEmpty()) {
-        m_tracks = m_dbManager->getAllTracks();
-    } else {
-        m_tracks = m_dbManager->searchTracks(m_currentSearchTerm);
+    // Sorted the way m_rows is, so rows in both keep their relative order
+    QVector<int> sorted = ascendingOrder(rows);
+    if (m_sortOrder == Qt::DescendingOrder) {
+        std::reverse(sorted.begin(), sorted.end());
+    }
+    invalidateSortCache();
+
+    // Small changes keep the view's scroll position and selection
+    const RowDiff diff(m_rows, sorted, m_store->size());
+    if (diff.changeCount() > m_searchDiffLimit) {
+        beginResetModel();
+        m_rows = sorted;
+        endResetModel();
+        return;
     }
 
-    sortTracks();
-    endResetModel();
+    for (const RowDiff::Range &range : diff.removals()) {
+        beginRemoveRows(QModelIndex(), range.first, range.first + range.count - 1);
+        m_rows.remove(range.first, range.count);
+        endRemoveRows();
+    }
+    for (const RowDiff::Range &range : diff.insertions()) {
+        beginInsertRows(QModelIndex(), range.first, range.first + range.count - 1);
+        m_rows.insert(range.first, range.count, 0);
+        std::copy(sorted.cbegin() + range.first, sorted.cbegin() + range.first + range.count,
+                  m_rows.begin() + range.first);
+        endInsertRows();
+    }
 }
 
 void MusicLibraryFlatModel::showAllTracks()
@@ -189,18 +349,307 @@ void MusicLibraryFlatModel::showAllTracks()
 
 MusicTrack MusicLibraryFlatModel::getTrack(const QModelIndex &index) const
 {
-    if (!index.isValid() || index.row() >= m_tracks.size()) {
+    if (!index.isValid() || index.row() >= m_rows.size()) {
         return MusicTrack();
     }
-    return m_tracks.at(index.row());
+    return m_store->track(m_rows.at(index.row()));
 }
 
 MusicTrack MusicLibraryFlatModel::getTrack(int row) const
 {
-    if (row < 0 || row >= m_tracks.size()) {
+    if (row < 0 || row >= m_rows.size()) {
         return MusicTrack();
     }
-    return m_tracks.at(row);
+    return m_store->track(m_rows.at(row));
+}
+
+bool MusicLibraryFlatModel::loadSnapshot(const LibrarySnapshot &snapshot)
+{
+    if (!snapshot.isOpen()) {
+        return false;
+    }
+
+    const quint32 orderKey = snapshotOrderKey(m_sortColumn, m_sortOrder);
+
+    // Fills the shared store; refreshData() then runs through tracksReset
+    QScopedValueRollback<bool> adoptOrder(m_adoptStoreOrder, snapshot.hasOrder(orderKey));
+    m_currentSearchTerm.clear();
+    m_store->setTracks(snapshot.tracks(orderKey), snapshot.revision());
+    return true;
+}
+
+bool MusicLibraryFlatModel::saveSnapshot(const QString &path, qint64 revision) const
+{
+    // A filtered list is not the library
+    if (!m_currentSearchTerm.isEmpty()) {
+        return false;
+    }
+
+    // Clicking the same header again is the common re-sort; store that order as a reversal
+    QVector<quint32> reversed(m_rows.size());
+    for (int i = 0; i < m_rows.size(); ++i) {
+        reversed[i] = quint32(m_rows.size() - 1 - i);
+    }
+
+    const Qt::SortOrder otherOrder = m_sortOrder == Qt::AscendingOrder ? Qt::DescendingOrder : Qt::AscendingOrder;
+    return LibrarySnapshot::write(path, revision, m_store->tracks(m_rows), snapshotOrderKey(m_sortColumn, m_sortOrder),
+                                  {{snapshotOrderKey(m_sortColumn, otherOrder), reversed}});
+}
+
+quint32 MusicLibraryFlatModel::snapshotOrderKey(int column, Qt::SortOrder order)
+{
+    return quint32(column) * 2 + quint32(order);
+}
+
+void MusicLibraryFlatModel::setStatistics(PlayStatistics *statistics)
+{
+    if (m_statistics) {
+        disconnect(m_statistics, nullptr, this, nullptr);
+    }
+
+    beginResetModel();
+    m_statistics = statistics;
+    endResetModel();
+
+    if (m_statistics) {
+        connect(m_statistics, &PlayStatistics::statisticsAboutToChange, this,
+                &MusicLibraryFlatModel::onStatisticsAboutToChange);
+        connect(m_statistics, &PlayStatistics::statisticsChanged, this, &MusicLibraryFlatModel::onStatisticsChanged);
+    }
+}
+
+TrackStatistics MusicLibraryFlatModel::statistics(int row) const
+{
+    // Held in memory by PlayStatistics, so painting and sorting never query per row
+    return m_statistics ? m_statistics->statistics(m_store->id(row)) : TrackStatistics();
+}
+
+bool MusicLibraryFlatModel::statisticsColumn(int column)
+{
+    return column == PlayCountColumn || column == LastPlayedColumn || column == SkipCountColumn;
+}
+
+void MusicLibraryFlatModel::onStatisticsAboutToChange(int trackId)
+{
+    // Only an order by the counts depends on them; find the row while they still place it
+    m_statisticsPosition = -1;
+    prepareSortKeys();
+    const int storeRow = m_store->rowForId(trackId);
+    if (storeRow >= 0 && statisticsColumn(m_sortColumn)) {
+        m_statisticsPosition = rowPosition(storeRow);
+    }
+}
+
+void MusicLibraryFlatModel::onStatisticsChanged(int trackId)
+{
+    const int storeRow = m_store->rowForId(trackId);
+    if (storeRow < 0) {
+        return;
+    }
+    prepareSortKeys();
+
+    // Cached orders by these columns are out of date
+    m_sortedRows.remove(PlayCountColumn);
+    m_sortedRows.remove(LastPlayedColumn);
+    m_sortedRows.remove(SkipCountColumn);
+
+    if (!statisticsColumn(m_sortColumn)) {
+        const int row = rowPosition(storeRow);
+        if (row >= 0) {
+            emit dataChanged(index(row, PlayCountColumn), index(row, SkipCountColumn));
+        }
+        return;
+    }
+
+    const int from = m_statisticsPosition;
+    m_statisticsPosition = -1;
+    if (from < 0) {
+        return;
+    }
+
+    const int to = moveToSortedPosition(from);
+    emit dataChanged(index(to, PlayCountColumn), index(to, SkipCountColumn));
+}
+
+void MusicLibraryFlatModel::onTracksAboutToChange(const QVector<int> &rows)
+{
+    // Find the shown rows while their old values still place them; once the
+    // store has changed, binary searches over them no longer work
+    prepareSortKeys();
+    m_changingPositions.clear();
+    for (int row : rows) {
+        const int position = rowPosition(row);
+        if (position >= 0) {
+            m_changingPositions.insert(row, position);
+        }
+    }
+}
+
+void MusicLibraryFlatModel::onTracksInserted(const QVector<int> &rows)
+{
+    // Binary search in the current order; the rest of the table, scroll position and selection are untouched
+    prepareSortKeys();
+    invalidateSortCache();
+    for (int row : rows) {
+        if (!matchesSearch(row)) {
+            continue;
+        }
+
+        const int position = insertPosition(row);
+        beginInsertRows(QModelIndex(), position, position);
+        m_rows.insert(position, row);
+        endInsertRows();
+    }
+}
+
+void MusicLibraryFlatModel::onTracksUpdated(const QVector<int> &rows)
+{
+    prepareSortKeys();
+    invalidateSortCache();
+
+    QVector<int> dropped;
+    QVector<int> shown;
+    QVector<int> added;
+    for (int row : rows) {
+        if (!m_changingPositions.contains(row)) {
+            added.append(row); // May match the search now
+        } else if (!matchesSearch(row)) {
+            dropped.append(row);
+        } else {
+            shown.append(row);
+        }
+    }
+    removeChangingRows(dropped);
+
+    if (shown.size() == 1) {
+        // The common single edit moves like a statistics change
+        const int to = moveToSortedPosition(m_changingPositions.value(shown.first()));
+        emit dataChanged(index(to, 0), index(to, ColumnCount - 1));
+    } else if (!shown.isEmpty()) {
+        // The rows left alone are still sorted; merge the changed ones back
+        // into them, and move rows only if the order actually changed
+        QVector<int> positions;
+        positions.reserve(shown.size());
+        for (int row : std::as_const(shown)) {
+            positions.append(m_changingPositions.value(row));
+        }
+        std::sort(positions.begin(), positions.end());
+
+        QVector<int> rest;
+        rest.reserve(m_rows.size() - positions.size());
+        int next = 0;
+        for (int position : std::as_const(positions)) {
+            rest.append(m_rows.mid(next, position - next));
+            next = position + 1;
+        }
+        rest.append(m_rows.mid(next));
+
+        const auto lessThan = [this](int left, int right) {
+            return trackLessThan(left, right);
+        };
+        std::sort(shown.begin(), shown.end(), lessThan);
+        QVector<int> merged(m_rows.size());
+        std::merge(rest.cbegin(), rest.cend(), shown.cbegin(), shown.cend(), merged.begin(), lessThan);
+
+        if (merged != m_rows) {
+            setRowOrder(merged);
+        }
+        for (int row : std::as_const(shown)) {
+            const int position = rowPosition(row);
+            emit dataChanged(index(position, 0), index(position, ColumnCount - 1));
+        }
+    }
+    m_changingPositions.clear();
+
+    onTracksInserted(added);
+}
+
+void MusicLibraryFlatModel::onTracksRemoved(const QVector<int> &rows)
+{
+    invalidateSortCache();
+    removeChangingRows(rows);
+}
+
+void MusicLibraryFlatModel::removeChangingRows(const QVector<int> &rows)
+{
+    QVector<int> positions;
+    for (int row : rows) {
+        auto it = m_changingPositions.find(row);
+        if (it != m_changingPositions.end()) {
+            positions.append(it.value());
+            m_changingPositions.erase(it);
+        }
+    }
+    if (positions.isEmpty()) {
+        return;
+    }
+    std::sort(positions.begin(), positions.end());
+
+    // Runs of adjacent rows go in one removal, last first
+    for (int i = positions.size() - 1; i >= 0;) {
+        const int last = positions.at(i);
+        int first = last;
+        while (--i >= 0 && positions.at(i) == first - 1) {
+            first = positions.at(i);
+        }
+        beginRemoveRows(QModelIndex(), first, last);
+        m_rows.remove(first, last - first + 1);
+        endRemoveRows();
+    }
+
+    // The rows still changing shift up past the ones removed before them
+    for (auto it = m_changingPositions.begin(); it != m_changingPositions.end(); ++it) {
+        it.value() -= int(std::lower_bound(positions.cbegin(), positions.cend(), it.value()) - positions.cbegin());
+    }
+}
+
+int MusicLibraryFlatModel::moveToSortedPosition(int from)
+{
+    // Find where the row's new values sort to, measured without the row itself
+    const int row = m_rows.at(from);
+    m_rows.removeAt(from);
+    const int to = insertPosition(row);
+    m_rows.insert(from, row);
+
+    if (to != from) {
+        beginMoveRows(QModelIndex(), from, from, QModelIndex(), to > from ? to + 1 : to);
+        m_rows.move(from, to);
+        endMoveRows();
+    }
+    return to;
+}
+
+int MusicLibraryFlatModel::insertPosition(int row) const
+{
+    auto it = std::upper_bound(m_rows.begin(), m_rows.end(), row, [this](int left, int right) {
+        return trackLessThan(left, right);
+    });
+    return int(it - m_rows.begin());
+}
+
+int MusicLibraryFlatModel::rowPosition(int row) const
+{
+    // The order is strict, so a row can only be where it would be inserted
+    auto it = std::lower_bound(m_rows.begin(), m_rows.end(), row, [this](int left, int right) {
+        return trackLessThan(left, right);
+    });
+    return it != m_rows.end() && *it == row ? int(it - m_rows.begin()) : -1;
+}
+
+bool MusicLibraryFlatModel::matchesSearch(int row) const
+{
+    return m_currentSearchTerm.isEmpty() || m_store->matches(row, m_currentSearchTerm);
+}
+
+QVector<int> MusicLibraryFlatModel::searchRows(const QString &searchTerm) const
+{
+    // Never the database: this runs on the GUI thread for every refresh during a
+    // search. An index created before this model drops its readiness on a store
+    // reset before the refresh asks it.
+    if (m_searchIndex && m_searchIndex->isReady()) {
+        return m_searchIndex->search(searchTerm);
+    }
+    return m_store->matchingRows(searchTerm);
 }
 
 QString MusicLibraryFlatModel::formatDuration(int seconds) const
@@ -214,78 +663,121 @@ QString MusicLibraryFlatModel::formatDuration(int seconds) const
     return QString("%1:%2").arg(minutes).arg(seconds, 2, 10, QChar('0'));
 }
 
-void MusicLibraryFlatModel::sortTracks()
+QVector<int> MusicLibraryFlatModel::sortedOrder()
 {
-    std::sort(m_tracks.begin(), m_tracks.end(), [this](const MusicTrack &left, const MusicTrack &right) {
-        return trackLessThan(left, right);
+    // Descending order is the ascending permutation reversed
+    auto it = m_sortedRows.constFind(m_sortColumn);
+    if (it == m_sortedRows.constEnd()) {
+        it = m_sortedRows.insert(m_sortColumn, ascendingOrder(m_rows));
+    }
+
+    QVector<int> rows = it.value();
+    if (m_sortOrder == Qt::DescendingOrder) {
+        std::reverse(rows.begin(), rows.end());
+    }
+    return rows;
+}
+
+QVector<int> MusicLibraryFlatModel::ascendingOrder(QVector<int> rows)
+{
+    prepareSortKeys();
+    const int column = m_sortColumn;
+    parallelSort(rows, [this, column](int left, int right) {
+        return compareRows(column, left, right) < 0;
     });
+    return rows;
 }
 
-bool MusicLibraryFlatModel::trackLessThan(const MusicTrack &left, const MusicTrack &right) const
+void MusicLibraryFlatModel::invalidateSortCache()
 {
-    QVariant leftValue, rightValue;
+    m_sortedRows.clear();
+}
 
-    switch (m_sortColumn) {
+bool MusicLibraryFlatModel::textColumn(int column, TrackStore::TextColumn *textColumn)
+{
+    switch (column) {
         case TitleColumn:
-            leftValue = left.title;
-            rightValue = right.title;
-            break;
+            *textColumn = TrackStore::TitleText;
+            return true;
         case ArtistColumn:
-            leftValue = left.artist;
-            rightValue = right.artist;
-            break;
+            *textColumn = TrackStore::ArtistText;
+            return true;
         case AlbumColumn:
-            leftValue = left.album;
-            rightValue = right.album;
-            break;
+            *textColumn = TrackStore::AlbumText;
+            return true;
         case GenreColumn:
-            leftValue = left.genre;
-            rightValue = right.genre;
-            break;
+            *textColumn = TrackStore::GenreText;
+            return true;
         case PublisherColumn:
-            leftValue = left.publisher;
-            rightValue = right.publisher;
-            break;
+            *textColumn = TrackStore::PublisherText;
+            return true;
         case CatalogNumberColumn:
-            leftValue = left.catalogNumber;
-            rightValue = right.catalogNumber;
-            break;
+            *textColumn = TrackStore::CatalogNumberText;
+            return true;
+        default:
+            return false;
+    }
+}
+
+void MusicLibraryFlatModel::prepareSortKeys()
+{
+    TrackStore::TextColumn column;
+    if (textColumn(m_sortColumn, &column)) {
+        m_store->prepareSortKeys(column);
+    }
+}
+
+int MusicLibraryFlatModel::compareRows(int column, int left, int right) const
+{
+    // Text columns compare the store's precomputed collation keys; nothing is allocated per comparison
+    TrackStore::TextColumn text;
+    if (textColumn(column, &text)) {
+        const int comparison = m_store->compareText(text, left, right);
+        return comparison != 0 ? comparison : compareValues(left, right);
+    }
+
+    qint64 leftValue = 0;
+    qint64 rightValue = 0;
+    switch (column) {
         case YearColumn:
-            leftValue = left.year;
-            rightValue = right.year;
+            leftValue = m_store->year(left);
+            rightValue = m_store->year(right);
             break;
         case TrackColumn:
-            leftValue = left.track;
-            rightValue = right.track;
+            leftValue = m_store->trackNumber(left);
+            rightValue = m_store->trackNumber(right);
             break;
         case DurationColumn:
-            leftValue = left.duration;
-            rightValue = right.duration;
+            leftValue = m_store->duration(left);
+            rightValue = m_store->duration(right);
             break;
-        default:
-            leftValue = left.title;
-            rightValue = right.title;
+        case PlayCountColumn:
+            leftValue = statistics(left).playCount;
+            rightValue = statistics(right).playCount;
+            break;
+        case LastPlayedColumn:
+            leftValue = statistics(left).lastPlayedMs;
+            rightValue = statistics(right).lastPlayedMs;
+            break;
+        case SkipCountColumn:
+            leftValue = statistics(left).skipCount;
+            rightValue = statistics(right).skipCount;
             break;
     }
 
-    // Handle different data types appropriately
-    if (leftValue.userType() == QMetaType::Int) {
-        int leftInt = leftValue.toInt();
-        int rightInt = rightValue.toInt();
-        if (m_sortOrder == Qt::AscendingOrder) {
-            return leftInt < rightInt;
-        } else {
-            return leftInt > rightInt;
-        }
-    } else {
-        QString leftStr = leftValue.toString().toLower();
-        QString rightStr = rightValue.toString().toLower();
-        if (m_sortOrder == Qt::AscendingOrder) {
-            return leftStr < rightStr;
-        } else {
-            return leftStr > rightStr;
-        }
-    }
+    // Equal values fall back to the store row, so every set of rows has exactly one order
+    return leftValue != rightValue ? compareValues(leftValue, rightValue) : compareValues(left, right);
+}
+
+int MusicLibraryFlatModel::compareValues(qint64 left, qint64 right)
+{
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+bool MusicLibraryFlatModel::trackLessThan(int left, int right) const
+{
+    const int comparison = compareRows(m_sortColumn, left, right);
+    return m_sortOrder == Qt::AscendingOrder ? comparison < 0 : comparison > 0;
 }
 
 // MusicLibraryFlatProxyModel implementation
@@ -3,7 +3,14 @@
 
 #include <QAbstractTableModel>
 #include <QSortFilterProxyModel>
+#include <QVector>
+#include <QHash>
 #include "databasemanager.h"
+#include "trackstore.h"
+
+class LibrarySnapshot;
+class PlayStatistics;
+class SearchIndex;
 
 class MusicLibraryFlatModel : public QAbstractTableModel
 {
@@ -20,10 +27,13 @@ public:
         YearColumn,
         TrackColumn,
         DurationColumn,
+        PlayCountColumn,
+        LastPlayedColumn,
+        SkipCountColumn,
         ColumnCount
     };
 
-    explicit MusicLibraryFlatModel(DatabaseManager *dbManager, QObject *parent = nullptr);
+    MusicLibraryFlatModel(DatabaseManager *dbManager, TrackStore *store, QObject *parent = nullptr);
     ~MusicLibraryFlatModel() = default;
 
     // QAbstractTableModel interface
@@ -36,22 +46,71 @@ public:
     void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
 
     // Custom methods
+    // Rebuilds the visible rows from the shared TrackStore; no database reload
     void refreshData();
     void searchTracks(const QString &searchTerm);
+    // Shows results fetched elsewhere, e.g. by AsyncQueryRunner
+    void setSearchResults(const QString &searchTerm, const QList<MusicTrack> &tracks);
+    // Shows store rows found in memory, e.g. by SearchIndex
+    void setSearchRows(const QString &searchTerm, const QVector<int> &rows);
+    // New search results changing more rows than this reset the model instead
+    // of being applied as row removals and insertions; 0 always resets
+    static const int DefaultSearchDiffLimit = 2000;
+    void setSearchDiffLimit(int limit) { m_searchDiffLimit = limit; }
     void showAllTracks();
     MusicTrack getTrack(const QModelIndex &index) const;
     MusicTrack getTrack(int row) const;
 
+    // Source of the play count, last played and skip count columns
+    void setStatistics(PlayStatistics *statistics);
+    // Answers searchTracks() and refreshes during a search; without a ready
+    // index the store is scanned instead
+    void setSearchIndex(SearchIndex *searchIndex) { m_searchIndex = searchIndex; }
+
+    // Cold-start snapshot of the unfiltered track list, stored in the current sort order
+    bool loadSnapshot(const LibrarySnapshot &snapshot);
+    bool saveSnapshot(const QString &path, qint64 revision) const;
+
 private:
     DatabaseManager *m_dbManager;
-    QList<MusicTrack> m_tracks;
+    TrackStore *m_store;
+    QVector<int> m_rows; // TrackStore rows in display order
+    QHash<int, QVector<int>> m_sortedRows; // m_rows in ascending order per column, until the rows change
     QString m_currentSearchTerm;
+    bool m_adoptStoreOrder; // The store was just filled in the current sort order
     int m_sortColumn;
     Qt::SortOrder m_sortOrder;
+    PlayStatistics *m_statistics;
+    SearchIndex *m_searchIndex;
+    int m_searchDiffLimit;
+    int m_statisticsPosition; // Of the track whose counts are changing, when sorted by them
+    QHash<int, int> m_changingPositions; // Shown store rows the store is rewriting, to their positions
 
     QString formatDuration(int seconds) const;
-    void sortTracks();
-    bool trackLessThan(const MusicTrack &left, const MusicTrack &right) const;
+    TrackStatistics statistics(int row) const;
+    static bool statisticsColumn(int column);
+    void onStatisticsAboutToChange(int trackId);
+    void onStatisticsChanged(int trackId);
+    void onTracksAboutToChange(const QVector<int> &rows);
+    void onTracksInserted(const QVector<int> &rows);
+    void onTracksUpdated(const QVector<int> &rows);
+    void onTracksRemoved(const QVector<int> &rows);
+    void removeChangingRows(const QVector<int> &rows);
+    int moveToSortedPosition(int from);
+    void setRowOrder(const QVector<int> &rows);
+    int insertPosition(int row) const;
+    int rowPosition(int row) const;
+    bool matchesSearch(int row) const;
+    QVector<int> searchRows(const QString &searchTerm) const;
+    QVector<int> sortedOrder();
+    QVector<int> ascendingOrder(QVector<int> rows);
+    void invalidateSortCache();
+    static quint32 snapshotOrderKey(int column, Qt::SortOrder order);
+    static bool textColumn(int column, TrackStore::TextColumn *textColumn);
+    void prepareSortKeys();
+    int compareRows(int column, int left, int right) const;
+    static int compareValues(qint64 left, qint64 right);
+    bool trackLessThan(int left, int right) const;
 };
 
 // Proxy model for additional filtering if needed
@@ -1,36 +1,50 @@
 #include "musiclibrarymodel.h"
+#include "musiclibraryarena.h"
+#include "trackstore.h"
+#include "rowdiff.h"
+#include "searchindex.h"
 #include <QIcon>
 #include <QFont>
+#include <QHash>
+#include <QSet>
+#include <QtConcurrent>
 #include <QDebug>
 #include <algorithm>
 
 // MusicLibraryItem implementation
 MusicLibraryItem::MusicLibraryItem(ItemType type, const QString &data, MusicLibraryItem *parent)
-    : m_parentItem(parent), m_type(type), m_text(data)
+    : m_parentItem(parent), m_type(type), m_text(data), m_row(0), m_trackRow(-1), m_id(-1), m_pendingChildCount(0)
 {
 }
 
-MusicLibraryItem::~MusicLibraryItem()
+void MusicLibraryItem::appendChild(MusicLibraryItem *child)
 {
-    qDeleteAll(m_childItems);
+    child->m_row = m_childItems.size();
+    m_childItems.append(child);
 }
 
-void MusicLibraryItem::appendChild(MusicLibraryItem *child)
+void MusicLibraryItem::insertChild(int row, MusicLibraryItem *child)
 {
-    m_childItems.append(child);
+    m_childItems.insert(row, child);
+    renumberChildren(row);
 }
 
-void MusicLibraryItem::removeChild(int row)
+MusicLibraryItem *MusicLibraryItem::takeChild(int row)
 {
-    if (row >= 0 && row < m_childItems.size()) {
-        delete m_childItems.takeAt(row);
+    if (row < 0 || row >= m_childItems.size()) {
+        return nullptr;
     }
+    MusicLibraryItem *child = m_childItems.takeAt(row);
+    renumberChildren(row);
+    return child;
 }
 
-void MusicLibraryItem::clearChildren()
+void MusicLibraryItem::renumberChildren(int from)
 {
-    qDeleteAll(m_childItems);
-    m_childItems.clear();
+    // Only the siblings that moved, the same ones the list itself shifted
+    for (int i = from; i < m_childItems.size(); ++i) {
+        m_childItems.at(i)->m_row = i;
+    }
 }
 
 MusicLibraryItem *MusicLibraryItem::child(int row) const
@@ -51,29 +65,30 @@ int MusicLibraryItem::columnCount() const
     return MusicLibraryModel::ColumnCount;
 }
 
-QVariant MusicLibraryItem::data(int column) const
+QVariant MusicLibraryItem::data(int column, const TrackStore *store) const
 {
     switch (m_type) {
         case TrackItem:
             switch (column) {
                 case MusicLibraryModel::TitleColumn:
-                    return m_track.title;
+                    return store->title(m_trackRow);
                 case MusicLibraryModel::ArtistColumn:
-                    return m_track.artist;
+                    return store->artist(m_trackRow);
                 case MusicLibraryModel::AlbumColumn:
-                    return m_track.album;
+                    return store->album(m_trackRow);
                 case MusicLibraryModel::GenreColumn:
-                    return m_track.genre;
+                    return store->genre(m_trackRow);
                 case MusicLibraryModel::PublisherColumn:
-                    return m_track.publisher;
+                    return store->publisher(m_trackRow);
                 case MusicLibraryModel::CatalogNumberColumn:
-                    return m_track.catalogNumber;
+                    return store->catalogNumber(m_trackRow);
                 case MusicLibraryModel::YearColumn:
-                    return m_track.year > 0 ? QString::number(m_track.year) : QString();
+                    return store->year(m_trackRow) > 0 ? QString::number(store->year(m_trackRow)) : QString();
                 case MusicLibraryModel::TrackColumn:
-                    return m_track.track > 0 ? QString::number(m_track.track) : QString();
+                    return store->trackNumber(m_trackRow) > 0 ? QString::number(store->trackNumber(m_trackRow))
+                                                              : QString();
                 case MusicLibraryModel::DurationColumn: {
-                    int seconds = m_track.duration;
+                    int seconds = store->duration(m_trackRow);
                     int minutes = seconds / 60;
                     seconds %= 60;
                     return QString("%1:%2").arg(minutes).arg(seconds, 2, 10, QChar('0'));
@@ -90,32 +105,43 @@ QVariant MusicLibraryItem::data(int column) const
     }
 }
 
-int MusicLibraryItem::row() const
-{
-    if (m_parentItem) {
-        return m_parentItem->m_childItems.indexOf(const_cast<MusicLibraryItem*>(this));
-    }
-    return 0;
-}
-
 MusicLibraryItem *MusicLibraryItem::parentItem() const
 {
     return m_parentItem;
 }
 
 // MusicLibraryModel implementation
-MusicLibraryModel::MusicLibraryModel(DatabaseManager *dbManager, QObject *parent)
+MusicLibraryModel::MusicLibraryModel(DatabaseManager *dbManager, TrackStore *store, QObject *parent)
     : QAbstractItemModel(parent)
     , m_dbManager(dbManager)
+    , m_store(store)
+    , m_searchIndex(nullptr)
     , m_sortMode(SortByArtistAlbum)
-{
-    m_rootItem = new MusicLibraryItem(MusicLibraryItem::RootItem, "Root");
+    , m_treeMode(SortByArtistAlbum)
+    , m_searchList(false)
+    , m_searchDiffLimit(DefaultSearchDiffLimit)
+    , m_buildGeneration(0)
+    , m_building(false)
+    , m_rebuildPending(false)
+{
+    m_arena.reset(new MusicLibraryArena);
+    m_rootItem = m_arena->create(MusicLibraryItem::RootItem, "Root");
+
+    // Items hold store rows, which a store reset invalidates. Scan changes are
+    // applied in place so expanded branches and the selection are kept.
+    connect(&m_buildWatcher, &QFutureWatcher<TreeBuild>::finished, this, &MusicLibraryModel::onBuildFinished);
+    connect(m_store, &TrackStore::tracksReset, this, &MusicLibraryModel::onTracksReset);
+    connect(m_store, &TrackStore::tracksInserted, this, &MusicLibraryModel::onTracksInserted);
+    connect(m_store, &TrackStore::tracksUpdated, this, &MusicLibraryModel::onTracksUpdated);
+    connect(m_store, &TrackStore::tracksRemoved, this, &MusicLibraryModel::onTracksRemoved);
     refreshData();
 }
 
 MusicLibraryModel::~MusicLibraryModel()
 {
-    delete m_rootItem;
+    // The worker reads the generation, so it has to finish first
+    cancelBuild();
+    m_buildWatcher.waitForFinished();
 }
 
 QVariant MusicLibraryModel::data(const QModelIndex &index, int role) const
@@ -128,7 +154,7 @@ QVariant MusicLibraryModel::data(const QModelIndex &index, int role) const
 
     switch (role) {
         case Qt::DisplayRole:
-            return item->data(index.column());
+            return item->data(index.column(), m_store);
 
         case Qt::FontRole: {
             QFont font;
@@ -143,7 +169,7 @@ QVariant MusicLibraryModel::data(const QModelIndex &index, int role) const
         case Qt::UserRole:
             // Return the track data for easy access
             if (item->type() == MusicLibraryItem::TrackItem) {
-                return QVariant::fromValue(item->track());
+                return QVariant::fromValue(m_store->track(item->trackRow()));
             }
             return QVariant();
 
@@ -225,50 +251,301 @@ int MusicLibraryModel::columnCount(const QModelIndex &parent) const
     return ColumnCount;
 }
 
+bool MusicLibraryModel::hasChildren(const QModelIndex &parent) const
+{
+    MusicLibraryItem *parentItem = getItem(parent);
+    return parentItem->childCount() > 0 || parentItem->pendingChildCount() > 0;
+}
+
+bool MusicLibraryModel::canFetchMore(const QModelIndex &parent) const
+{
+    return getItem(parent)->pendingChildCount() > 0;
+}
+
+void MusicLibraryModel::fetchMore(const QModelIndex &parent)
+{
+    MusicLibraryItem *parentItem = getItem(parent);
+    if (parentItem->pendingChildCount() == 0) {
+        return;
+    }
+    parentItem->setPendingChildCount(0);
+
+    QList<MusicLibraryItem*> children;
+    if (m_treeMode != SortByArtistAlbum) {
+        // Album, genre and year groups hold their tracks directly
+        const QVector<int> rows = m_store->rowsFor(tracksInGroup(parentItem->id()));
+        for (int row : rows) {
+            children.append(createTrackItem(row, parentItem));
+        }
+    } else if (parentItem->type() == MusicLibraryItem::ArtistItem) {
+        const QList<AlbumSummary> albums = m_dbManager->getAlbumsByArtist(parentItem->id());
+        for (const AlbumSummary &album : albums) {
+            MusicLibraryItem *albumItem = m_arena->create(MusicLibraryItem::AlbumItem, album.name, parentItem);
+            albumItem->setId(album.id);
+            albumItem->setPendingChildCount(album.trackCount);
+            m_albumItems.insert(pairKey(parentItem->id(), album.id), albumItem);
+            children.append(albumItem);
+        }
+    } else if (parentItem->type() == MusicLibraryItem::AlbumItem && parentItem->parentItem()) {
+        const QVector<int> rows = m_store->rowsFor(m_dbManager->getTracksByAlbum(parentItem->parentItem()->id(),
+                                                                                 parentItem->id()));
+        for (int row : rows) {
+            children.append(createTrackItem(row, parentItem));
+        }
+    }
+
+    if (children.isEmpty()) {
+        return;
+    }
+
+    beginInsertRows(parent, 0, children.size() - 1);
+    parentItem->reserveChildren(children.size());
+    for (MusicLibraryItem *child : children) {
+        parentItem->appendChild(child);
+    }
+    endInsertRows();
+}
+
 void MusicLibraryModel::refreshData()
 {
+    // A search keeps its flat list whatever the grouping; it is refilled in
+    // memory, and the tree is built once the search is cleared
+    if (!m_currentSearchTerm.isEmpty()) {
+        setSearchRows(m_currentSearchTerm, searchRows(m_currentSearchTerm));
+        return;
+    }
+
+    // The tree on display stays up until the new one is swapped in. A build
+    // still running for an older request is cancelled and this one follows it.
+    m_buildGeneration.fetchAndAddOrdered(1);
+    if (m_building) {
+        m_rebuildPending = true;
+        return;
+    }
+    startBuild();
+}
+
+void MusicLibraryModel::onTracksReset()
+{
+    // The items hold row numbers the reset made meaningless
+    m_hiddenTree = HiddenTree();
+    beginResetModel();
+    clearTree();
+    m_searchList = false;
+    endResetModel();
+    refreshData();
+}
+
+void MusicLibraryModel::startBuild()
+{
+    m_rebuildPending = false;
+    m_pendingRows.clear();
+
+    // Only the unfiltered library is built as a tree; searches show a flat list
+    m_building = true;
+    m_buildWatcher.setFuture(QtConcurrent::run(&MusicLibraryModel::buildTree, m_store->groupingColumns(),
+                                               m_store->allRows(), m_sortMode, &m_buildGeneration,
+                                               m_buildGeneration.loadAcquire()));
+}
+
+void MusicLibraryModel::onBuildFinished()
+{
+    m_building = false;
+    TreeBuild build = m_buildWatcher.result();
+
+    if (build.generation != m_buildGeneration.loadAcquire()) {
+        if (m_rebuildPending) {
+            startBuild();
+            return;
+        }
+        // Superseded by search results shown in the meantime
+        const QVector<int> rows = m_pendingRows;
+        m_pendingRows.clear();
+        if (!rows.isEmpty()) {
+            onTracksUpdated(rows);
+        }
+        return;
+    }
+
+    // The only work left on the GUI thread: one short reset, and freeing
+    // the old tree's arena
     beginResetModel();
-    setupModelData();
+    m_arena = build.arena;
+    m_rootItem = build.root;
+    m_trackItems.clear();
+    m_groupItems = std::move(build.groupItems);
+    m_albumItems = std::move(build.albumItems);
+    m_treeMode = build.mode;
+    m_searchList = false;
     endResetModel();
+    qDebug() << "Library tree replaced with" << m_rootItem->childCount() << "groups";
+
+    // Catch up with store changes made while the build ran
+    const QVector<int> rows = m_pendingRows;
+    m_pendingRows.clear();
+    onTracksUpdated(rows);
+
+    emit treeReplaced();
+}
+
+void MusicLibraryModel::cancelBuild()
+{
+    m_buildGeneration.fetchAndAddOrdered(1);
+    m_rebuildPending = false;
 }
 
 void MusicLibraryModel::searchTracks(const QString &searchTerm)
 {
     qDebug() << "MusicLibraryModel::searchTracks called with:" << searchTerm;
+
+    if (searchTerm.isEmpty()) {
+        showAllTracks();
+        return;
+    }
+
+    setSearchRows(searchTerm, searchRows(searchTerm));
+}
+
+void MusicLibraryModel::setSearchResults(const QString &searchTerm, const QList<MusicTrack> &tracks)
+{
+    setSearchRows(searchTerm, m_store->rowsFor(tracks));
+}
+
+void MusicLibraryModel::setSearchRows(const QString &searchTerm, const QVector<int> &rows)
+{
+    // A tree still building for an earlier request would replace these results
+    cancelBuild();
     m_currentSearchTerm = searchTerm;
-    beginResetModel();
 
-    m_rootItem->clearChildren();
+    // Listed in store order, so rows in both the old and new results keep their relative order
+    QVector<int> sorted = rows;
+    std::sort(sorted.begin(), sorted.end());
 
-    if (searchTerm.isEmpty()) {
-        qDebug() << "Empty search term, showing all tracks";
-        setupModelData();
-    } else {
-        QList<MusicTrack> tracks = m_dbManager->searchTracks(searchTerm);
-        qDebug() << "Database returned" << tracks.size() << "tracks for search";
-
-        // For search results, show flat list of tracks
-        for (const MusicTrack &track : tracks) {
-            MusicLibraryItem *trackItem = new MusicLibraryItem(MusicLibraryItem::TrackItem, track.title, m_rootItem);
-            trackItem->setTrack(track);
-            m_rootItem->appendChild(trackItem);
+    QVector<int> current;
+    if (m_searchList) {
+        current.reserve(m_rootItem->childCount());
+        for (int i = 0; i < m_rootItem->childCount(); ++i) {
+            current.append(m_rootItem->child(i)->trackRow());
         }
     }
 
-    endResetModel();
+    // Coming from a grouped tree, or too many changes: rebuild
+    const RowDiff diff(current, sorted, m_store->size());
+    if (!m_searchList || diff.changeCount() > m_searchDiffLimit) {
+        beginResetModel();
+        if (!m_searchList && m_rootItem->childCount() > 0) {
+            hideTree();
+        } else {
+            clearTree();
+        }
+        m_searchList = true;
+        appendSearchResults(sorted);
+        endResetModel();
+        return;
+    }
+
+    for (const RowDiff::Range &range : diff.removals()) {
+        beginRemoveRows(QModelIndex(), range.first, range.first + range.count - 1);
+        for (int i = 0; i < range.count; ++i) {
+            MusicLibraryItem *item = m_rootItem->takeChild(range.first);
+            m_trackItems.remove(item->trackRow());
+            m_arena->release(item);
+        }
+        endRemoveRows();
+    }
+    for (const RowDiff::Range &range : diff.insertions()) {
+        beginInsertRows(QModelIndex(), range.first, range.first + range.count - 1);
+        for (int i = range.first; i < range.first + range.count; ++i) {
+            m_rootItem->insertChild(i, createTrackItem(sorted.at(i), m_rootItem));
+        }
+        endInsertRows();
+    }
+}
+
+QVector<int> MusicLibraryModel::searchRows(const QString &searchTerm) const
+{
+    // Never the database: this runs on the GUI thread for every refresh during a search
+    if (m_searchIndex && m_searchIndex->isReady()) {
+        return m_searchIndex->search(searchTerm);
+    }
+    return m_store->matchingRows(searchTerm);
+}
+
+void MusicLibraryModel::appendSearchResults(const QVector<int> &rows)
+{
+    // For search results, show flat list of tracks
+    for (int row : rows) {
+        m_rootItem->appendChild(createTrackItem(row, m_rootItem));
+    }
+}
+
+MusicLibraryItem *MusicLibraryModel::createTrackItem(int row, MusicLibraryItem *parent)
+{
+    MusicLibraryItem *trackItem = m_arena->create(MusicLibraryItem::TrackItem, QString(), parent);
+    trackItem->setTrackRow(row);
+    m_trackItems.insert(row, trackItem);
+    return trackItem;
 }
 
 void MusicLibraryModel::showAllTracks()
 {
     m_currentSearchTerm.clear();
-    refreshData();
+    if (!restoreHiddenTree()) {
+        refreshData();
+    }
+}
+
+void MusicLibraryModel::hideTree()
+{
+    m_hiddenTree.arena = m_arena;
+    m_hiddenTree.root = m_rootItem;
+    m_hiddenTree.trackItems = std::move(m_trackItems);
+    m_hiddenTree.groupItems = std::move(m_groupItems);
+    m_hiddenTree.albumItems = std::move(m_albumItems);
+    m_hiddenTree.mode = m_treeMode;
+    clearTree();
+}
+
+bool MusicLibraryModel::restoreHiddenTree()
+{
+    HiddenTree tree = std::move(m_hiddenTree);
+    m_hiddenTree = HiddenTree();
+    if (!tree.arena || !m_searchList || tree.mode != m_sortMode) {
+        return false;
+    }
+    cancelBuild();
+
+    // A layout change rather than a reset keeps the selection and current
+    // index on tracks whose branch the tree had already fetched
+    emit layoutAboutToBeChanged();
+    const QModelIndexList persistent = persistentIndexList();
+    QModelIndexList moved;
+    moved.reserve(persistent.size());
+    for (const QModelIndex &index : persistent) {
+        MusicLibraryItem *item = tree.trackItems.value(getItem(index)->trackRow());
+        moved.append(item ? createIndex(item->row(), index.column(), item) : QModelIndex());
+    }
+    changePersistentIndexList(persistent, moved);
+
+    m_arena = tree.arena;
+    m_rootItem = tree.root;
+    m_trackItems = std::move(tree.trackItems);
+    m_groupItems = std::move(tree.groupItems);
+    m_albumItems = std::move(tree.albumItems);
+    m_treeMode = tree.mode;
+    m_searchList = false;
+    emit layoutChanged();
+    qDebug() << "Library tree restored with" << m_rootItem->childCount() << "groups";
+
+    emit treeReplaced();
+    return true;
 }
 
 MusicTrack MusicLibraryModel::getTrack(const QModelIndex &index) const
 {
     MusicLibraryItem *item = getItem(index);
     if (item && item->type() == MusicLibraryItem::TrackItem) {
-        return item->track();
+        return m_store->track(item->trackRow());
     }
     return MusicTrack();
 }
@@ -281,152 +558,447 @@ void MusicLibraryModel::setSortMode(SortMode mode)
     }
 }
 
-void MusicLibraryModel::addTrackToModel(const MusicTrack &track)
+bool MusicLibraryModel::populatesLazily() const
 {
-    // Only add if we're not in search mode or if the track matches the search
-    if (!m_currentSearchTerm.isEmpty()) {
-        QString searchLower = m_currentSearchTerm.toLower();
-        if (!track.title.toLower().contains(searchLower) &&
-            !track.artist.toLower().contains(searchLower) &&
-            !track.album.toLower().contains(searchLower) &&
-            !track.genre.toLower().contains(searchLower)) {
-            return; // Track doesn't match current search, don't add
-        }
+    // Search results are a flat list of tracks; only the library tree fetches on expansion
+    return m_currentSearchTerm.isEmpty();
+}
+
+QList<MusicTrack> MusicLibraryModel::tracksInGroup(int id) const
+{
+    switch (m_treeMode) {
+        case SortByAlbum:
+            return m_dbManager->getTracksByAlbumId(id);
+        case SortByGenre:
+            return m_dbManager->getTracksByGenreId(id);
+        case SortByYear:
+            return m_dbManager->getTracksByYear(id);
+        default:
+            return QList<MusicTrack>();
     }
+}
 
-    // For simplicity during scanning, we'll do a lightweight refresh
-    // This could be optimized further by inserting into the correct position
-    refreshData();
+QString MusicLibraryModel::yearText(int year)
+{
+    return year > 0 ? QString::number(year) : "Unknown Year";
 }
 
-void MusicLibraryModel::updateTrackInModel(const MusicTrack &track)
+void MusicLibraryModel::onTracksInserted(const QVector<int> &rows)
 {
-    // For updates, also do a refresh for now
-    // In a more sophisticated implementation, we'd find and update the specific item
-    refreshData();
+    m_hiddenTree = HiddenTree();
+    if (m_building) {
+        m_pendingRows += rows;
+        return;
+    }
+    for (int row : rows) {
+        if (m_trackItems.contains(row)) {
+            continue;
+        }
+        MusicLibraryItem *parentItem = parentForTrack(row);
+        if (parentItem) {
+            insertItem(parentItem, trackPosition(parentItem, row), createTrackItem(row, parentItem));
+        }
+    }
 }
 
-void MusicLibraryModel::setupModelData()
+void MusicLibraryModel::onTracksUpdated(const QVector<int> &rows)
 {
-    qDebug() << "setupModelData() called";
-    m_rootItem->clearChildren();
+    m_hiddenTree = HiddenTree();
+    if (m_building) {
+        m_pendingRows += rows;
+        return;
+    }
+    for (int row : rows) {
+        MusicLibraryItem *item = m_trackItems.value(row);
+        MusicLibraryItem *parentItem = parentForTrack(row);
+
+        if (!item) {
+            // Now matches the search, or was not loaded before
+            if (parentItem) {
+                insertItem(parentItem, trackPosition(parentItem, row), createTrackItem(row, parentItem));
+            }
+            continue;
+        }
 
-    QList<MusicTrack> tracks;
-    if (m_currentSearchTerm.isEmpty()) {
-        tracks = m_dbManager->getAllTracks();
-        qDebug() << "Getting all tracks, found:" << tracks.size();
-    } else {
-        tracks = m_dbManager->searchTracks(m_currentSearchTerm);
-        qDebug() << "Getting search tracks for '" << m_currentSearchTerm << "', found:" << tracks.size();
+        if (!parentItem) {
+            removeItem(item);
+            continue;
+        }
+
+        MusicLibraryItem *oldParent = item->parentItem();
+        if (parentItem == oldParent) {
+            // A new track number can move it within a fetched album, which is
+            // ordered by them; find its place measured without the item itself
+            const bool byTrackNumber = !m_searchList && m_sortMode == SortByArtistAlbum;
+            const int from = item->row();
+            int to = from;
+            if (byTrackNumber) {
+                parentItem->takeChild(from);
+                to = trackPosition(parentItem, row);
+                parentItem->insertChild(from, item);
+            }
+            if (to != from) {
+                const QModelIndex parentIndex = indexForItem(parentItem);
+                beginMoveRows(parentIndex, from, from, parentIndex, to > from ? to + 1 : to);
+                parentItem->insertChild(to, parentItem->takeChild(from));
+                endMoveRows();
+            }
+            emit dataChanged(indexForItem(item), indexForItem(item, ColumnCount - 1));
+            continue;
+        }
+
+        // Retagged into another group
+        const int from = item->row();
+        const int to = trackPosition(parentItem, row);
+        beginMoveRows(indexForItem(oldParent), from, from, indexForItem(parentItem), to);
+        parentItem->insertChild(to, oldParent->takeChild(from));
+        item->setParentItem(parentItem);
+        endMoveRows();
+        removeIfEmpty(oldParent);
+    }
+}
+
+void MusicLibraryModel::onTracksRemoved(const QVector<int> &rows)
+{
+    m_hiddenTree = HiddenTree();
+    if (m_building) {
+        m_pendingRows += rows;
+        return;
+    }
+    for (int row : rows) {
+        MusicLibraryItem *item = m_trackItems.value(row);
+        if (item) {
+            removeItem(item);
+        }
+    }
+}
+
+MusicLibraryItem *MusicLibraryModel::parentForTrack(int row)
+{
+    // Removed rows come through here when held back during a build
+    if (m_store->id(row) < 0) {
+        return nullptr;
+    }
+    if (!m_currentSearchTerm.isEmpty() && !m_store->matches(row, m_currentSearchTerm)) {
+        return nullptr;
+    }
+    if (m_searchList) {
+        return m_rootItem;
     }
 
+    // Groups are keyed by database id, like the summaries the tree was built to match
+    MusicLibraryItem *groupItem = nullptr;
+
     switch (m_sortMode) {
         case SortByArtistAlbum:
-            buildArtistAlbumTree(tracks);
+            groupItem = findOrCreateGroup(m_store->artistId(row), m_store->artist(row), MusicLibraryItem::ArtistItem);
+            if (groupItem->pendingChildCount() > 0) {
+                return nullptr;
+            }
+            groupItem = findOrCreateAlbum(groupItem, m_store->albumId(row), m_store->album(row));
             break;
         case SortByAlbum:
-            buildAlbumTree(tracks);
+            groupItem = findOrCreateGroup(m_store->albumId(row), m_store->album(row), MusicLibraryItem::AlbumItem);
             break;
         case SortByGenre:
-            buildGenreTree(tracks);
+            groupItem = findOrCreateGroup(m_store->genreId(row), m_store->genre(row), MusicLibraryItem::ArtistItem);
             break;
-        case SortByYear:
-            buildYearTree(tracks);
+        case SortByYear: {
+            const int year = m_store->year(row) > 0 ? m_store->year(row) : 0;
+            groupItem = findOrCreateGroup(year, yearText(year), MusicLibraryItem::ArtistItem);
             break;
+        }
     }
+
+    // Branches that were never expanded read the track from the database when they are
+    return groupItem && groupItem->pendingChildCount() == 0 ? groupItem : nullptr;
 }
 
-void MusicLibraryModel::buildArtistAlbumTree(const QList<MusicTrack> &tracks)
+MusicLibraryItem *MusicLibraryModel::findOrCreateGroup(int key, const QString &text,
+                                                       MusicLibraryItem::ItemType type)
 {
-    QMap<QString, MusicLibraryItem*> artistItems;
-    QMap<QString, MusicLibraryItem*> albumItems;
+    MusicLibraryItem *groupItem = m_groupItems.value(key);
+    if (groupItem) {
+        return groupItem;
+    }
 
-    for (const MusicTrack &track : tracks) {
-        // Get or create artist item
-        MusicLibraryItem *artistItem = artistItems.value(track.artist);
-        if (!artistItem) {
-            artistItem = new MusicLibraryItem(MusicLibraryItem::ArtistItem, track.artist, m_rootItem);
-            artistItems[track.artist] = artistItem;
-            m_rootItem->appendChild(artistItem);
-        }
+    groupItem = m_arena->create(type, text, m_rootItem);
+    groupItem->setId(key);
+    groupItem->setPendingChildCount(1);
+    m_groupItems.insert(key, groupItem);
+    insertItem(m_rootItem, sortedPosition(m_rootItem, groupItem), groupItem);
+    return groupItem;
+}
+
+MusicLibraryItem *MusicLibraryModel::findOrCreateAlbum(MusicLibraryItem *artistItem, int key,
+                                                       const QString &text)
+{
+    const quint64 albumKey = pairKey(artistItem->id(), key);
+    MusicLibraryItem *albumItem = m_albumItems.value(albumKey);
+    if (albumItem) {
+        return albumItem;
+    }
+
+    albumItem = m_arena->create(MusicLibraryItem::AlbumItem, text, artistItem);
+    albumItem->setId(key);
+    albumItem->setPendingChildCount(1);
+    m_albumItems.insert(albumKey, albumItem);
+    insertItem(artistItem, sortedPosition(artistItem, albumItem), albumItem);
+    return albumItem;
+}
+
+int MusicLibraryModel::trackPosition(MusicLibraryItem *parent, int row) const
+{
+    // Search results stay in store order and fetched artist albums in the
+    // database order by track number; other groups append
+    const bool byRow = m_searchList;
+    if (!byRow && m_sortMode != SortByArtistAlbum) {
+        return parent->childCount();
+    }
 
-        // Get or create album item under artist
-        QString albumKey = track.artist + " - " + track.album;
-        MusicLibraryItem *albumItem = albumItems.value(albumKey);
-        if (!albumItem) {
-            albumItem = new MusicLibraryItem(MusicLibraryItem::AlbumItem, track.album, artistItem);
-            albumItems[albumKey] = albumItem;
-            artistItem->appendChild(albumItem);
+    int low = 0;
+    int high = parent->childCount();
+    const int key = byRow ? row : m_store->trackNumber(row);
+    while (low < high) {
+        const int middle = (low + high) / 2;
+        const int childRow = parent->child(middle)->trackRow();
+        if ((byRow ? childRow : m_store->trackNumber(childRow)) <= key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+int MusicLibraryModel::sortedPosition(MusicLibraryItem *parent, MusicLibraryItem *item) const
+{
+    // Lazy levels follow the database ORDER BY name, or by year for year groups
+    const bool byYear = m_sortMode == SortByYear;
+    int low = 0;
+    int high = parent->childCount();
+    while (low < high) {
+        const int middle = (low + high) / 2;
+        const MusicLibraryItem *other = parent->child(middle);
+        if (byYear ? other->id() <= item->id() : other->text() <= item->text()) {
+            low = middle + 1;
+        } else {
+            high = middle;
         }
+    }
+    return low;
+}
 
-        // Create track item
-        MusicLibraryItem *trackItem = new MusicLibraryItem(MusicLibraryItem::TrackItem, track.title, albumItem);
-        trackItem->setTrack(track);
-        albumItem->appendChild(trackItem);
+void MusicLibraryModel::insertItem(MusicLibraryItem *parent, int position, MusicLibraryItem *item)
+{
+    beginInsertRows(indexForItem(parent), position, position);
+    parent->insertChild(position, item);
+    item->setParentItem(parent);
+    endInsertRows();
+}
+
+void MusicLibraryModel::removeItem(MusicLibraryItem *item)
+{
+    MusicLibraryItem *parentItem = item->parentItem();
+    if (item->type() == MusicLibraryItem::TrackItem) {
+        m_trackItems.remove(item->trackRow());
+    } else if (parentItem == m_rootItem) {
+        m_groupItems.remove(item->id());
+    } else {
+        m_albumItems.remove(pairKey(parentItem->id(), item->id()));
+    }
+
+    const int position = item->row();
+    beginRemoveRows(indexForItem(parentItem), position, position);
+    m_arena->release(parentItem->takeChild(position));
+    endRemoveRows();
+
+    removeIfEmpty(parentItem);
+}
+
+void MusicLibraryModel::removeIfEmpty(MusicLibraryItem *group)
+{
+    // Children that were never fetched still exist in the database
+    if (group != m_rootItem && group->childCount() == 0 && group->pendingChildCount() == 0) {
+        removeItem(group);
+    }
+}
+
+QModelIndex MusicLibraryModel::indexForItem(MusicLibraryItem *item, int column) const
+{
+    if (item == m_rootItem) {
+        return QModelIndex();
     }
+    return createIndex(item->row(), column, item);
+}
+
+void MusicLibraryModel::clearTree()
+{
+    // Dropping the arena frees the whole tree at once
+    m_arena.reset(new MusicLibraryArena);
+    m_rootItem = m_arena->create(MusicLibraryItem::RootItem, "Root");
+    m_trackItems.clear();
+    m_groupItems.clear();
+    m_albumItems.clear();
 }
 
-void MusicLibraryModel::buildAlbumTree(const QList<MusicTrack> &tracks)
+MusicLibraryModel::TreeBuild MusicLibraryModel::buildTree(const TrackStore::GroupingColumns &columns,
+                                                         const QVector<int> &rows, SortMode mode,
+                                                         const QAtomicInt *generation, int expected)
 {
-    QMap<QString, MusicLibraryItem*> albumItems;
+    TreeBuild build;
+    build.arena.reset(new MusicLibraryArena(itemEstimate(columns, mode)));
+    build.root = build.arena->create(MusicLibraryItem::RootItem, "Root");
+    build.mode = mode;
+    build.generation = expected;
+
+    const CancelCheck cancelled = [generation, expected]() {
+        return generation->loadRelaxed() != expected;
+    };
+
+    bool complete;
+    if (mode == SortByArtistAlbum) {
+        complete = buildArtistSummaryTree(build, columns, rows, cancelled);
+    } else {
+        complete = buildGroupTree(build, columns, rows, cancelled);
+    }
+
+    if (!complete) {
+        build.arena.reset();
+        build.root = nullptr;
+    }
+    return build;
+}
 
-    for (const MusicTrack &track : tracks) {
-        // Get or create album item
-        MusicLibraryItem *albumItem = albumItems.value(track.album);
-        if (!albumItem) {
-            albumItem = new MusicLibraryItem(MusicLibraryItem::AlbumItem, track.album, m_rootItem);
-            albumItems[track.album] = albumItem;
-            m_rootItem->appendChild(albumItem);
+bool MusicLibraryModel::buildArtistSummaryTree(TreeBuild &build, const TrackStore::GroupingColumns &columns,
+                                               const QVector<int> &rows, const CancelCheck &cancelled)
+{
+    // Only the artist level is built up front, keyed and ordered like the
+    // database summaries; albums and tracks are fetched on expansion
+    QHash<int, int> albumCounts;
+    QHash<int, int> nameKeys;
+    QSet<quint64> artistAlbums;
+    for (int i = 0; i < rows.size(); ++i) {
+        if ((i & 0xfff) == 0 && cancelled()) {
+            return false;
+        }
+        const int row = rows.at(i);
+        const int artistId = columns.artistIds.at(row);
+        const quint64 albumKey = pairKey(artistId, columns.albumIds.at(row));
+        if (!artistAlbums.contains(albumKey)) {
+            artistAlbums.insert(albumKey);
+            ++albumCounts[artistId];
+            nameKeys.insert(artistId, columns.artistKeys.at(row));
         }
+    }
 
-        // Create track item
-        MusicLibraryItem *trackItem = new MusicLibraryItem(MusicLibraryItem::TrackItem, track.title, albumItem);
-        trackItem->setTrack(track);
-        albumItem->appendChild(trackItem);
+    QList<int> artistIds = albumCounts.keys();
+    std::sort(artistIds.begin(), artistIds.end(), [&](int left, int right) {
+        return columns.artistNames.at(nameKeys.value(left)) < columns.artistNames.at(nameKeys.value(right));
+    });
+
+    build.root->reserveChildren(artistIds.size());
+    for (int artistId : std::as_const(artistIds)) {
+        MusicLibraryItem *artistItem = build.arena->create(MusicLibraryItem::ArtistItem,
+                                                           columns.artistNames.at(nameKeys.value(artistId)),
+                                                           build.root);
+        artistItem->setId(artistId);
+        artistItem->setPendingChildCount(albumCounts.value(artistId));
+        build.groupItems.insert(artistId, artistItem);
+        build.root->appendChild(artistItem);
     }
+    return !cancelled();
 }
 
-void MusicLibraryModel::buildGenreTree(const QList<MusicTrack> &tracks)
+bool MusicLibraryModel::buildGroupTree(TreeBuild &build, const TrackStore::GroupingColumns &columns,
+                                       const QVector<int> &rows, const CancelCheck &cancelled)
 {
-    QMap<QString, MusicLibraryItem*> genreItems;
+    // Album, genre and year groups hold their tracks directly. The build
+    // only counts them, for fetchMore() to read on expansion.
+    const MusicLibraryItem::ItemType type = build.mode == SortByAlbum ? MusicLibraryItem::AlbumItem
+                                                                      : MusicLibraryItem::ArtistItem;
 
-    for (const MusicTrack &track : tracks) {
-        // Get or create genre item
-        MusicLibraryItem *genreItem = genreItems.value(track.genre);
-        if (!genreItem) {
-            genreItem = new MusicLibraryItem(MusicLibraryItem::ArtistItem, track.genre, m_rootItem);
-            genreItems[track.genre] = genreItem;
-            m_rootItem->appendChild(genreItem);
+    QVector<MusicLibraryItem*> groups;
+    for (int i = 0; i < rows.size(); ++i) {
+        if ((i & 0xfff) == 0 && cancelled()) {
+            return false;
         }
+        const int row = rows.at(i);
+        const int key = groupKey(columns, row, build.mode);
+
+        // Get or create group item
+        MusicLibraryItem *&groupItem = build.groupItems[key];
+        if (!groupItem) {
+            groupItem = build.arena->create(type, groupText(columns, row, build.mode), build.root);
+            groupItem->setId(key);
+            groups.append(groupItem);
+        }
+        groupItem->setPendingChildCount(groupItem->pendingChildCount() + 1);
+    }
 
-        // Create track item
-        MusicLibraryItem *trackItem = new MusicLibraryItem(MusicLibraryItem::TrackItem, track.title, genreItem);
-        trackItem->setTrack(track);
-        genreItem->appendChild(trackItem);
+    // Same order as the database summaries: by name, years by number
+    const bool byYear = build.mode == SortByYear;
+    std::sort(groups.begin(), groups.end(), [byYear](MusicLibraryItem *left, MusicLibraryItem *right) {
+        return byYear ? left->id() < right->id() : left->text() < right->text();
+    });
+    build.root->reserveChildren(groups.size());
+    for (MusicLibraryItem *groupItem : std::as_const(groups)) {
+        build.root->appendChild(groupItem);
     }
+    return !cancelled();
 }
 
-void MusicLibraryModel::buildYearTree(const QList<MusicTrack> &tracks)
+int MusicLibraryModel::groupKey(const TrackStore::GroupingColumns &columns, int row, SortMode mode)
 {
-    QMap<int, MusicLibraryItem*> yearItems;
-
-    for (const MusicTrack &track : tracks) {
-        int year = track.year > 0 ? track.year : 0;
-        QString yearText = year > 0 ? QString::number(year) : "Unknown Year";
+    // Keyed by database id, which fetchMore() passes back to the database
+    switch (mode) {
+        case SortByArtistAlbum:
+            return columns.artistIds.at(row);
+        case SortByAlbum:
+            return columns.albumIds.at(row);
+        case SortByGenre:
+            return columns.genreIds.at(row);
+        case SortByYear:
+            return columns.years.at(row) > 0 ? columns.years.at(row) : 0;
+    }
+    return 0;
+}
 
-        // Get or create year item
-        MusicLibraryItem *yearItem = yearItems.value(year);
-        if (!yearItem) {
-            yearItem = new MusicLibraryItem(MusicLibraryItem::ArtistItem, yearText, m_rootItem);
-            yearItems[year] = yearItem;
-            m_rootItem->appendChild(yearItem);
-        }
+QString MusicLibraryModel::groupText(const TrackStore::GroupingColumns &columns, int row, SortMode mode)
+{
+    switch (mode) {
+        case SortByArtistAlbum:
+            return columns.artistNames.at(columns.artistKeys.at(row));
+        case SortByAlbum:
+            return columns.albumNames.at(columns.albumKeys.at(row));
+        case SortByGenre:
+            return columns.genreNames.at(columns.genreKeys.at(row));
+        case SortByYear:
+            return yearText(columns.years.at(row));
+    }
+    return QString();
+}
 
-        // Create track item
-        MusicLibraryItem *trackItem = new MusicLibraryItem(MusicLibraryItem::TrackItem, track.title, yearItem);
-        trackItem->setTrack(track);
-        yearItem->appendChild(trackItem);
+int MusicLibraryModel::itemEstimate(const TrackStore::GroupingColumns &columns, SortMode mode)
+{
+    // Distinct values seen by the store bound the groups; an estimate that
+    // falls short only costs a second block
+    int groups = 0;
+    switch (mode) {
+        case SortByArtistAlbum:
+            groups = columns.artistNames.size();
+            break;
+        case SortByAlbum:
+            groups = columns.albumNames.size();
+            break;
+        case SortByGenre:
+            groups = columns.genreNames.size();
+            break;
+        case SortByYear:
+            groups = 200;
+            break;
     }
+    return 1 + groups;
 }
 
 QString MusicLibraryModel::formatDuration(int seconds) const
@@ -5,8 +5,21 @@
 #include <QModelIndex>
 #include <QVariant>
 #include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QSharedPointer>
+#include <QAtomicInt>
+#include <QFutureWatcher>
+#include <functional>
 #include "databasemanager.h"
+#include "trackstore.h"
 
+class MusicLibraryArena;
+class SearchIndex;
+
+// A node of the library tree. Items are allocated by a MusicLibraryArena,
+// which owns them; removing a child only unlinks it. Each item knows its
+// own row, so finding an item's position never searches its parent.
 class MusicLibraryItem
 {
 public:
@@ -19,17 +32,20 @@ public:
 
     explicit MusicLibraryItem(ItemType type, const QString &data = QString(),
                              MusicLibraryItem *parent = nullptr);
-    ~MusicLibraryItem();
 
     void appendChild(MusicLibraryItem *child);
-    void removeChild(int row);
-    void clearChildren();
+    // Sizes the child list once when the number of children is known up front
+    void reserveChildren(int count) { m_childItems.reserve(count); }
+    void insertChild(int row, MusicLibraryItem *child);
+    // Detaches for moving to another parent or for MusicLibraryArena::release()
+    MusicLibraryItem *takeChild(int row);
 
     MusicLibraryItem *child(int row) const;
     int childCount() const;
     int columnCount() const;
-    QVariant data(int column) const;
-    int row() const;
+    // Track items read their columns from the shared store
+    QVariant data(int column, const TrackStore *store) const;
+    int row() const { return m_row; }
     MusicLibraryItem *parentItem() const;
     void setParentItem(MusicLibraryItem *parent) { m_parentItem = parent; }
 
@@ -37,16 +53,28 @@ public:
     QString text() const { return m_text; }
     void setText(const QString &text) { m_text = text; }
 
-    // For track items
-    MusicTrack track() const { return m_track; }
-    void setTrack(const MusicTrack &track) { m_track = track; }
+    // For track items: the row in the model's TrackStore
+    int trackRow() const { return m_trackRow; }
+    void setTrackRow(int row) { m_trackRow = row; }
+
+    // Group key: database id (or year) for lazily populated groups,
+    // otherwise the store key (or year) the group was built from
+    int id() const { return m_id; }
+    void setId(int id) { m_id = id; }
+    int pendingChildCount() const { return m_pendingChildCount; }
+    void setPendingChildCount(int count) { m_pendingChildCount = count; }
 
 private:
-    QList<MusicLibraryItem*> m_childItems;
+    void renumberChildren(int from);
+
+    QVector<MusicLibraryItem*> m_childItems; // Stays empty, and unallocated, for tracks
     MusicLibraryItem *m_parentItem;
     ItemType m_type;
     QString m_text;
-    MusicTrack m_track;
+    int m_row;
+    int m_trackRow;
+    int m_id;
+    int m_pendingChildCount;
 };
 
 class MusicLibraryModel : public QAbstractItemModel
@@ -67,7 +95,7 @@ public:
         ColumnCount
     };
 
-    explicit MusicLibraryModel(DatabaseManager *dbManager, QObject *parent = nullptr);
+    MusicLibraryModel(DatabaseManager *dbManager, TrackStore *store, QObject *parent = nullptr);
     ~MusicLibraryModel();
 
     // QAbstractItemModel interface
@@ -80,14 +108,23 @@ public:
     QModelIndex parent(const QModelIndex &index) const override;
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
     int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
 
     // Custom methods
     void refreshData();
     void searchTracks(const QString &searchTerm);
+    // Shows results fetched elsewhere, e.g. by AsyncQueryRunner
+    void setSearchResults(const QString &searchTerm, const QList<MusicTrack> &tracks);
+    // Shows store rows found in memory, e.g. by SearchIndex
+    void setSearchRows(const QString &searchTerm, const QVector<int> &rows);
+    // New search results changing more rows than this reset the model instead
+    // of being applied as row removals and insertions; 0 always resets
+    static const int DefaultSearchDiffLimit = 2000;
+    void setSearchDiffLimit(int limit) { m_searchDiffLimit = limit; }
     void showAllTracks();
     MusicTrack getTrack(const QModelIndex &index) const;
-    void addTrackToModel(const MusicTrack &track);
-    void updateTrackInModel(const MusicTrack &track);
 
     enum SortMode {
         SortByArtistAlbum,
@@ -97,18 +134,102 @@ public:
     };
 
     void setSortMode(SortMode mode);
+    bool populatesLazily() const;
+    // Answers searches and refreshes during a search; without a ready index
+    // the store is scanned instead
+    void setSearchIndex(SearchIndex *searchIndex) { m_searchIndex = searchIndex; }
+
+signals:
+    // A tree built in the background was swapped in
+    void treeReplaced();
 
 private:
+    // A grouping tree built off the GUI thread, with the indexes for incremental updates.
+    // Only the top level is built; the rest is fetched on expansion.
+    struct TreeBuild {
+        MusicLibraryItem *root = nullptr; // In arena
+        QHash<int, MusicLibraryItem*> groupItems;
+        QHash<quint64, MusicLibraryItem*> albumItems;
+        QSharedPointer<MusicLibraryArena> arena;
+        SortMode mode = SortByArtistAlbum;
+        int generation = 0;
+    };
+    using CancelCheck = std::function<bool()>;
+
+    // The library tree set aside while search results are listed, with what it
+    // had fetched, so clearing the search swaps it back without a rebuild
+    struct HiddenTree {
+        QSharedPointer<MusicLibraryArena> arena; // Null when there is none
+        MusicLibraryItem *root = nullptr;
+        QHash<int, MusicLibraryItem*> trackItems;
+        QHash<int, MusicLibraryItem*> groupItems;
+        QHash<quint64, MusicLibraryItem*> albumItems;
+        SortMode mode = SortByArtistAlbum;
+    };
+
     DatabaseManager *m_dbManager;
+    TrackStore *m_store;
+    SearchIndex *m_searchIndex;
+    QSharedPointer<MusicLibraryArena> m_arena; // Owns every item of the tree on display
     MusicLibraryItem *m_rootItem;
     SortMode m_sortMode;
     QString m_currentSearchTerm;
-
-    void setupModelData();
-    void buildArtistAlbumTree(const QList<MusicTrack> &tracks);
-    void buildAlbumTree(const QList<MusicTrack> &tracks);
-    void buildGenreTree(const QList<MusicTrack> &tracks);
-    void buildYearTree(const QList<MusicTrack> &tracks);
+    SortMode m_treeMode; // Grouping of the tree on display; m_sortMode may be building
+    bool m_searchList; // Root holds a flat list of search results, in store order
+    int m_searchDiffLimit;
+
+    // Background builds. Each request bumps the generation, which cancels a
+    // build still running for an older one; only one build runs at a time.
+    QFutureWatcher<TreeBuild> m_buildWatcher;
+    QAtomicInt m_buildGeneration;
+    bool m_building;
+    bool m_rebuildPending;
+    QVector<int> m_pendingRows; // Store changes held back while a build runs
+
+    // Indexes for incremental updates, rebuilt with the tree
+    QHash<int, MusicLibraryItem*> m_trackItems; // By store row
+    QHash<int, MusicLibraryItem*> m_groupItems; // Top level, by group key
+    QHash<quint64, MusicLibraryItem*> m_albumItems; // Albums under an artist, by both keys
+    HiddenTree m_hiddenTree; // Dropped on any store change, which it would miss
+
+    void onTracksReset();
+    void startBuild();
+    void onBuildFinished();
+    void cancelBuild();
+    void onTracksInserted(const QVector<int> &rows);
+    void onTracksUpdated(const QVector<int> &rows);
+    void onTracksRemoved(const QVector<int> &rows);
+    MusicLibraryItem *parentForTrack(int row);
+    // Lazy groups are placed by name and left for fetchMore(); others are appended
+    MusicLibraryItem *findOrCreateGroup(int key, const QString &text, MusicLibraryItem::ItemType type);
+    MusicLibraryItem *findOrCreateAlbum(MusicLibraryItem *artistItem, int key, const QString &text);
+    int trackPosition(MusicLibraryItem *parent, int row) const;
+    int sortedPosition(MusicLibraryItem *parent, MusicLibraryItem *item) const;
+    void insertItem(MusicLibraryItem *parent, int position, MusicLibraryItem *item);
+    void removeItem(MusicLibraryItem *item);
+    void removeIfEmpty(MusicLibraryItem *group);
+    QModelIndex indexForItem(MusicLibraryItem *item, int column = 0) const;
+    static quint64 pairKey(int artistKey, int albumKey) { return (quint64(quint32(artistKey)) << 32) | quint32(albumKey); }
+
+    void clearTree();
+    void hideTree();
+    bool restoreHiddenTree();
+    QList<MusicTrack> tracksInGroup(int id) const;
+    static QString yearText(int year);
+
+    // Run on the worker: they read only the column copies and return false once cancelled
+    static TreeBuild buildTree(const TrackStore::GroupingColumns &columns, const QVector<int> &rows,
+                               SortMode mode, const QAtomicInt *generation, int expected);
+    static bool buildArtistSummaryTree(TreeBuild &build, const TrackStore::GroupingColumns &columns,
+                                       const QVector<int> &rows, const CancelCheck &cancelled);
+    static bool buildGroupTree(TreeBuild &build, const TrackStore::GroupingColumns &columns,
+                               const QVector<int> &rows, const CancelCheck &cancelled);
+    static int groupKey(const TrackStore::GroupingColumns &columns, int row, SortMode mode);
+    static QString groupText(const TrackStore::GroupingColumns &columns, int row, SortMode mode);
+    static int itemEstimate(const TrackStore::GroupingColumns &columns, SortMode mode);
+    QVector<int> searchRows(const QString &searchTerm) const;
+    void appendSearchResults(const QVector<int> &rows);
+    MusicLibraryItem *createTrackItem(int row, MusicLibraryItem *parent);
 
     QString formatDuration(int seconds) const;
     MusicLibraryItem *getItem(const QModelIndex &index) const;
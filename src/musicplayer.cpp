@@ -175,6 +175,8 @@ void MusicPlayer::connectSignals()
 
 void MusicPlayer::playTrack(const MusicTrack &track)
 {
+    reportSkip();
+
     // Clear queue and add this track
     clearQueue();
     addToQueue(track);
@@ -251,6 +253,7 @@ void MusicPlayer::stop()
 void MusicPlayer::next()
 {
     if (m_currentIndex < m_queue.size() - 1) {
+        reportSkip();
         m_currentIndex++;
         playCurrentTrack();
     }
@@ -259,6 +262,7 @@ void MusicPlayer::next()
 void MusicPlayer::previous()
 {
     if (m_currentIndex > 0) {
+        reportSkip();
         m_currentIndex--;
         playCurrentTrack();
     }
@@ -316,6 +320,7 @@ void MusicPlayer::onPlaybackStateChanged(QMediaPlayer::PlaybackState state)
 void MusicPlayer::onQueueItemDoubleClicked(int row)
 {
     if (row >= 0 && row < m_queue.size()) {
+        reportSkip();
         m_currentIndex = row;
         playCurrentTrack();
     }
@@ -434,6 +439,14 @@ void MusicPlayer::loadNextTrack()
     }
 }
 
+void MusicPlayer::reportSkip()
+{
+    // At EndOfMedia the player has already stopped, so a finished track never counts
+    if (m_currentTrack.id >= 0 && m_mediaPlayer->playbackState() != QMediaPlayer::StoppedState) {
+        emit trackSkipped(m_currentTrack);
+    }
+}
+
 QString MusicPlayer::formatTime(qint64 milliseconds)
 {
     int seconds = static_cast<int>(milliseconds / 1000);
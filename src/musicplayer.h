@@ -44,6 +44,8 @@ public slots:
 
 signals:
     void trackChanged(const MusicTrack &track);
+    // The user moved on from a track before it finished
+    void trackSkipped(const MusicTrack &track);
 
 private:
     void setupUI();
@@ -52,6 +54,7 @@ private:
     void updateTrackInfo(const MusicTrack &track);
     void playCurrentTrack();
     void loadNextTrack();
+    void reportSkip();
     QString formatTime(qint64 milliseconds);
 
     // Media components
@@ -2,7 +2,12 @@
 #include <QDir>
 #include <QDirIterator>
 #include <QFileInfo>
+#include <QFile>
 #include <QDebug>
+#include <QtConcurrent>
+#ifndef Q_OS_WIN
+#include <sys/stat.h>
+#endif
 #include <taglib/fileref.h>
 #include <taglib/tag.h>
 #include <taglib/audioproperties.h>
@@ -18,6 +23,19 @@
 #include <taglib/xiphcomment.h>
 #include <taglib/mp4tag.h>
 
+// Bump a field set's entry when what its extractor reads changes (e.g. a new
+// catalog-number frame), or every entry when extractMetadata() itself changes.
+// Rows written by an older version are reread by reextractStale().
+static const int ExtractorVersions[MusicScanner::FieldSetCount] = {
+    1, // GenericFields
+    1, // Id3v2Fields
+    1, // XiphFields
+    1  // Mp4Fields
+};
+
+// Files handed to the thread pool at a time; each chunk is written in one transaction
+static const int ReextractChunkSize = 256;
+
 MusicScanner::MusicScanner(DatabaseManager *dbManager, QObject *parent)
     : QObject(parent)
     , m_dbManager(dbManager)
@@ -27,6 +45,7 @@ MusicScanner::MusicScanner(DatabaseManager *dbManager, QObject *parent)
     , m_tracksAdded(0)
     , m_tracksUpdated(0)
     , m_batchSize(10) // Process 10 files per timer tick
+    , m_reextracting(false)
     , m_musicDirectory("/mnt/shucked/Music") // Default music directory
 {
     // Set default supported formats
@@ -39,6 +58,16 @@ MusicScanner::MusicScanner(DatabaseManager *dbManager, QObject *parent)
     m_processTimer.setSingleShot(true);
     m_processTimer.setInterval(0); // Process files as fast as possible
     connect(&m_processTimer, &QTimer::timeout, this, &MusicScanner::processBatch);
+    connect(&m_extractWatcher, &QFutureWatcher<MusicTrack>::finished, this, &MusicScanner::onReextractChunkFinished);
+}
+
+QHash<int, int> MusicScanner::extractorVersions()
+{
+    QHash<int, int> versions;
+    for (int fieldSet = 0; fieldSet < FieldSetCount; ++fieldSet) {
+        versions.insert(fieldSet, ExtractorVersions[fieldSet]);
+    }
+    return versions;
 }
 
 void MusicScanner::setMusicDirectory(const QString &directory)
@@ -106,8 +135,15 @@ void MusicScanner::stopScanning()
     m_processTimer.stop();
     m_scanInProgress = false;
 
-    // Commit any pending transactions
-    m_dbManager->commitTransaction();
+    if (m_reextracting) {
+        // Results of the chunk in flight are dropped; those rows stay stale
+        m_extractWatcher.cancel();
+        m_extractWatcher.waitForFinished();
+        m_reextracting = false;
+    } else {
+        // Commit any pending transactions
+        m_dbManager->commitTransaction();
+    }
 
     qDebug() << "Scan stopped by user";
     emit scanCompleted(m_tracksFound, m_tracksAdded, m_tracksUpdated);
@@ -122,10 +158,7 @@ void MusicScanner::processBatch()
     if (m_currentFileIndex >= m_filesToProcess.size()) {
         // Scanning completed - commit transaction
         m_dbManager->commitTransaction();
-        m_scanInProgress = false;
-        qDebug() << "Scan completed. Found:" << m_tracksFound
-                 << "Added:" << m_tracksAdded << "Updated:" << m_tracksUpdated;
-        emit scanCompleted(m_tracksFound, m_tracksAdded, m_tracksUpdated);
+        finishScan();
         return;
     }
 
@@ -161,22 +194,23 @@ void MusicScanner::processNextFile()
     emit trackScanned(filePath);
 
     try {
-        // Check if track already exists in database
-        bool trackExists = m_dbManager->trackExists(filePath);
+        // Compare size and mtime with the stored signature before touching the tags
+        FileSignature signature = readFileSignature(filePath);
+        if (!signature.isValid()) {
+            qWarning() << "Could not stat file:" << filePath;
+            return;
+        }
 
-        if (trackExists) {
-            // Check if file has been modified since last scan
-            MusicTrack existingTrack = m_dbManager->getTrackByPath(filePath);
-            QFileInfo fileInfo(filePath);
+        FileSignature storedSignature = m_dbManager->getFileSignature(filePath);
+        bool trackExists = storedSignature.isValid();
 
-            if (!isFileNewer(filePath, existingTrack.lastModified)) {
-                // File hasn't changed, skip it
-                return;
-            }
+        if (trackExists && storedSignature.matches(signature)) {
+            // File hasn't changed, skip it
+            return;
         }
 
         // Extract metadata
-        MusicTrack track = extractMetadata(filePath);
+        MusicTrack track = extractMetadata(filePath, signature);
 
         if (track.filePath.isEmpty()) {
             // Failed to extract metadata, skip file
@@ -208,7 +242,84 @@ void MusicScanner::processNextFile()
     } catch (...) {
         qWarning() << "Unknown error processing file:" << filePath;
     }
-}void MusicScanner::findMusicFiles(const QString &directory, QStringList &files)
+}
+
+void MusicScanner::reextractStale()
+{
+    if (m_scanInProgress) {
+        return;
+    }
+
+    m_filesToProcess = m_dbManager->getStaleTrackPaths(extractorVersions());
+    m_tracksFound = m_filesToProcess.size();
+    m_tracksAdded = 0;
+    m_tracksUpdated = 0;
+    m_currentFileIndex = 0;
+
+    qDebug() << "Re-extracting tags for" << m_tracksFound << "tracks from older extractors";
+
+    m_scanInProgress = true;
+    m_reextracting = true;
+    emit scanStarted();
+
+    if (m_tracksFound == 0) {
+        finishScan();
+        return;
+    }
+
+    startReextractChunk();
+}
+
+void MusicScanner::startReextractChunk()
+{
+    const QStringList chunk = m_filesToProcess.mid(m_currentFileIndex, ReextractChunkSize);
+    m_currentFileIndex += chunk.size();
+    m_extractWatcher.setFuture(QtConcurrent::mapped(chunk, &MusicScanner::extractFile));
+}
+
+void MusicScanner::onReextractChunkFinished()
+{
+    if (!m_reextracting || m_extractWatcher.isCanceled()) {
+        return;
+    }
+
+    // Writes stay on this thread's connection; only tag reading runs in the pool
+    const QList<MusicTrack> tracks = m_extractWatcher.future().results();
+    m_dbManager->beginTransaction();
+    for (const MusicTrack &track : tracks) {
+        if (track.filePath.isEmpty()) {
+            // Missing or unreadable now; a normal scan deals with it
+            continue;
+        }
+
+        if (m_dbManager->updateTrack(track)) {
+            m_tracksUpdated++;
+            emit trackUpdated(track);
+        } else {
+            qWarning() << "Failed to save track to database:" << track.filePath;
+        }
+    }
+    m_dbManager->commitTransaction();
+
+    emit scanProgress(m_currentFileIndex, m_tracksFound);
+
+    if (m_currentFileIndex < m_filesToProcess.size()) {
+        startReextractChunk();
+    } else {
+        finishScan();
+    }
+}
+
+void MusicScanner::finishScan()
+{
+    m_scanInProgress = false;
+    m_reextracting = false;
+    qDebug() << "Scan completed. Found:" << m_tracksFound
+             << "Added:" << m_tracksAdded << "Updated:" << m_tracksUpdated;
+    emit scanCompleted(m_tracksFound, m_tracksAdded, m_tracksUpdated);
+}
+
+void MusicScanner::findMusicFiles(const QString &directory, QStringList &files)
 {
     QStringList nameFilters;
     for (const QString &format : m_supportedFormats) {
@@ -223,7 +334,7 @@ void MusicScanner::processNextFile()
     }
 }
 
-MusicTrack MusicScanner::extractMetadata(const QString &filePath)
+MusicTrack MusicScanner::extractMetadata(const QString &filePath, const FileSignature &signature)
 {
     MusicTrack track;
 
@@ -272,10 +383,13 @@ MusicTrack MusicScanner::extractMetadata(const QString &filePath)
             track.duration = properties->lengthInSeconds();
         }
 
-        // Get file information
-        QFileInfo fileInfo(filePath);
-        track.fileSize = fileInfo.size();
-        track.lastModified = fileInfo.lastModified();
+        // File information from the signature read before extraction
+        track.fileSize = signature.size;
+        track.mtimeNs = signature.mtimeNs;
+
+        const TagFieldSet fieldSet = fieldSetFor(fileRef);
+        track.fieldSet = fieldSet;
+        track.extractorVersion = ExtractorVersions[fieldSet];
 
     } catch (const std::exception &e) {
         qWarning() << "Exception while extracting metadata from" << filePath << ":" << e.what();
@@ -288,10 +402,53 @@ MusicTrack MusicScanner::extractMetadata(const QString &filePath)
     return track;
 }
 
-bool MusicScanner::isFileNewer(const QString &filePath, const QDateTime &dbModified)
+MusicTrack MusicScanner::extractFile(const QString &filePath)
 {
+    FileSignature signature = readFileSignature(filePath);
+    if (!signature.isValid()) {
+        qWarning() << "Could not stat file:" << filePath;
+        return MusicTrack();
+    }
+    return extractMetadata(filePath, signature);
+}
+
+MusicScanner::TagFieldSet MusicScanner::fieldSetFor(const TagLib::FileRef &fileRef)
+{
+    // Mirrors the format-specific branches of extractPublisher() and extractCatalogNumber()
+    TagLib::File *file = fileRef.file();
+    if (TagLib::MPEG::File *mpegFile = dynamic_cast<TagLib::MPEG::File*>(file)) {
+        return mpegFile->ID3v2Tag() ? Id3v2Fields : GenericFields;
+    }
+    if (TagLib::FLAC::File *flacFile = dynamic_cast<TagLib::FLAC::File*>(file)) {
+        return flacFile->xiphComment() ? XiphFields : GenericFields;
+    }
+    if (dynamic_cast<TagLib::MP4::File*>(file)) {
+        return Mp4Fields;
+    }
+    return GenericFields;
+}
+
+FileSignature MusicScanner::readFileSignature(const QString &filePath)
+{
+    // stat() directly: QFileInfo::lastModified() goes through QDateTime and drops sub-millisecond precision
+#ifdef Q_OS_WIN
     QFileInfo fileInfo(filePath);
-    return fileInfo.lastModified() > dbModified;
+    if (!fileInfo.exists()) {
+        return FileSignature();
+    }
+    return FileSignature(fileInfo.size(), fileInfo.lastModified().toMSecsSinceEpoch() * 1000000);
+#else
+    struct stat fileStat;
+    if (stat(QFile::encodeName(filePath).constData(), &fileStat) != 0) {
+        return FileSignature();
+    }
+#ifdef Q_OS_MACOS
+    const struct timespec &mtime = fileStat.st_mtimespec;
+#else
+    const struct timespec &mtime = fileStat.st_mtim;
+#endif
+    return FileSignature(fileStat.st_size, qint64(mtime.tv_sec) * 1000000000 + mtime.tv_nsec);
+#endif
 }
 
 QString MusicScanner::extractPublisher(const TagLib::FileRef &fileRef)
@@ -6,6 +6,8 @@
 #include <QStringList>
 #include <QFileInfo>
 #include <QTimer>
+#include <QHash>
+#include <QFutureWatcher>
 #include "databasemanager.h"
 
 // Forward declarations
@@ -18,13 +20,28 @@ class MusicScanner : public QObject
     Q_OBJECT
 
 public:
+    // Format-specific tag readers; each row records which one filled it and at what version
+    enum TagFieldSet {
+        GenericFields = 0, // TagLib's common tag and property map only
+        Id3v2Fields,       // MPEG files with an ID3v2 tag (TPUB, TXXX frames)
+        XiphFields,        // FLAC Vorbis comments
+        Mp4Fields,         // MP4/M4A item atoms
+        FieldSetCount
+    };
+
     explicit MusicScanner(DatabaseManager *dbManager, QObject *parent = nullptr);
 
+    // Current extractor version for every field set
+    static QHash<int, int> extractorVersions();
+
     void setMusicDirectory(const QString &directory);
+    QString musicDirectory() const { return m_musicDirectory; }
     void setSupportedFormats(const QStringList &formats);
 
 public slots:
     void scanLibrary();
+    // Rereads tags only for rows written by an older extractor, on a thread pool
+    void reextractStale();
     void stopScanning();
 
 signals:
@@ -38,6 +55,7 @@ signals:
 
 private slots:
     void processNextFile();
+    void onReextractChunkFinished();
 
 private:
     DatabaseManager *m_dbManager;
@@ -52,15 +70,22 @@ private:
     int m_tracksAdded;
     int m_tracksUpdated;
     int m_batchSize; // Number of files to process per timer tick
+    bool m_reextracting;
+    QFutureWatcher<MusicTrack> m_extractWatcher;
 
     void findMusicFiles(const QString &directory, QStringList &files);
-    MusicTrack extractMetadata(const QString &filePath);
-    bool isFileNewer(const QString &filePath, const QDateTime &dbModified);
+    // Extraction touches no scanner state, so it can run on worker threads
+    static MusicTrack extractMetadata(const QString &filePath, const FileSignature &signature);
+    static MusicTrack extractFile(const QString &filePath);
+    static FileSignature readFileSignature(const QString &filePath);
+    static TagFieldSet fieldSetFor(const TagLib::FileRef &fileRef);
     void processBatch();
+    void startReextractChunk();
+    void finishScan();
 
     // Helper functions for extended metadata extraction
-    QString extractPublisher(const TagLib::FileRef &fileRef);
-    QString extractCatalogNumber(const TagLib::FileRef &fileRef);
+    static QString extractPublisher(const TagLib::FileRef &fileRef);
+    static QString extractCatalogNumber(const TagLib::FileRef &fileRef);
 };
 
 #endif // MUSICSCANNER_H
@@ -0,0 +1,91 @@
+#include "playstatistics.h"
+#include <QDateTime>
+#include <QDebug>
+
+// Longest a recorded event waits in memory before it is written
+static const int FlushDelayMs = 30000;
+
+PlayStatistics::PlayStatistics(DatabaseManager *dbManager, QObject *parent)
+    : QObject(parent)
+    , m_dbManager(dbManager)
+{
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(FlushDelayMs);
+    connect(&m_flushTimer, &QTimer::timeout, this, &PlayStatistics::flush);
+}
+
+PlayStatistics::~PlayStatistics()
+{
+    // Whatever the last flush could not write is lost
+    if (!m_pending.isEmpty()) {
+        qWarning() << "Dropping" << m_pending.size() << "unflushed play statistics updates";
+    }
+}
+
+void PlayStatistics::load()
+{
+    m_statistics = m_dbManager->getPlayStatistics();
+
+    // Keep events recorded before the load
+    for (auto it = m_pending.constBegin(); it != m_pending.constEnd(); ++it) {
+        TrackStatistics &entry = m_statistics[it.key()];
+        entry.playCount += it.value().playCount;
+        entry.skipCount += it.value().skipCount;
+        entry.lastPlayedMs = qMax(entry.lastPlayedMs, it.value().lastPlayedMs);
+    }
+}
+
+void PlayStatistics::recordPlay(const MusicTrack &track)
+{
+    if (track.id < 0) {
+        return;
+    }
+
+    emit statisticsAboutToChange(track.id);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    pendingEntry(track).playCount++;
+    pendingEntry(track).lastPlayedMs = now;
+
+    TrackStatistics &entry = m_statistics[track.id];
+    entry.playCount++;
+    entry.lastPlayedMs = now;
+    emit statisticsChanged(track.id);
+}
+
+void PlayStatistics::recordSkip(const MusicTrack &track)
+{
+    if (track.id < 0) {
+        return;
+    }
+
+    emit statisticsAboutToChange(track.id);
+    pendingEntry(track).skipCount++;
+    m_statistics[track.id].skipCount++;
+    emit statisticsChanged(track.id);
+}
+
+TrackStatistics &PlayStatistics::pendingEntry(const MusicTrack &track)
+{
+    if (!m_flushTimer.isActive()) {
+        m_flushTimer.start();
+    }
+    return m_pending[track.id];
+}
+
+void PlayStatistics::flush()
+{
+    m_flushTimer.stop();
+    if (m_pending.isEmpty()) {
+        return;
+    }
+
+    // Fails while another transaction (e.g. a scan batch) is open; keep the deltas and retry
+    if (!m_dbManager->addPlayStatistics(m_pending)) {
+        qWarning() << "Deferring" << m_pending.size() << "play statistics updates";
+        m_flushTimer.start();
+        return;
+    }
+
+    qDebug() << "Flushed play statistics for" << m_pending.size() << "tracks";
+    m_pending.clear();
+}
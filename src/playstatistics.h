@@ -0,0 +1,45 @@
+#ifndef PLAYSTATISTICS_H
+#define PLAYSTATISTICS_H
+
+#include <QObject>
+#include <QHash>
+#include <QTimer>
+#include "databasemanager.h"
+
+// In-memory view of the play_stats table. Plays and skips update the view
+// immediately and are queued as deltas; the queue is written in one batched
+// transaction when the flush timer fires or flush() is called at shutdown,
+// so playback never waits on a SQLite write.
+class PlayStatistics : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PlayStatistics(DatabaseManager *dbManager, QObject *parent = nullptr);
+    ~PlayStatistics();
+
+    void load();
+    void recordPlay(const MusicTrack &track);
+    void recordSkip(const MusicTrack &track);
+
+    // Stored counts plus anything not yet flushed
+    TrackStatistics statistics(int trackId) const { return m_statistics.value(trackId); }
+
+public slots:
+    void flush();
+
+signals:
+    // Around every change to one track's counts, so views sorted by them can find it first
+    void statisticsAboutToChange(int trackId);
+    void statisticsChanged(int trackId);
+
+private:
+    DatabaseManager *m_dbManager;
+    QHash<int, TrackStatistics> m_statistics;
+    QHash<int, TrackStatistics> m_pending;
+    QTimer m_flushTimer;
+
+    TrackStatistics &pendingEntry(const MusicTrack &track);
+};
+
+#endif // PLAYSTATISTICS_H
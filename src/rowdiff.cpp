@@ -0,0 +1,42 @@
+#include "rowdiff.h"
+#include <QBitArray>
+
+RowDiff::RowDiff(const QVector<int> &oldRows, const QVector<int> &newRows, int rowLimit)
+    : m_changeCount(0)
+{
+    QBitArray inOld(rowLimit);
+    QBitArray inNew(rowLimit);
+    for (int row : oldRows) {
+        inOld.setBit(row);
+    }
+    for (int row : newRows) {
+        inNew.setBit(row);
+    }
+
+    for (int i = oldRows.size() - 1; i >= 0;) {
+        if (inNew.testBit(oldRows.at(i))) {
+            --i;
+            continue;
+        }
+        const int last = i;
+        while (i >= 0 && !inNew.testBit(oldRows.at(i))) {
+            --i;
+        }
+        m_removals.append({i + 1, last - i});
+        m_changeCount += last - i;
+    }
+
+    // Every new row before a run is in place by the time the run is inserted
+    for (int i = 0; i < newRows.size();) {
+        if (inOld.testBit(newRows.at(i))) {
+            ++i;
+            continue;
+        }
+        const int first = i;
+        while (i < newRows.size() && !inOld.testBit(newRows.at(i))) {
+            ++i;
+        }
+        m_insertions.append({first, i - first});
+        m_changeCount += i - first;
+    }
+}
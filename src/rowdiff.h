@@ -0,0 +1,36 @@
+#ifndef ROWDIFF_H
+#define ROWDIFF_H
+
+#include <QVector>
+
+// Turns one list of TrackStore rows into another with row removals and
+// insertions, so a model can emit them instead of a reset. Rows present in
+// both lists must appear in the same relative order, which holds whenever
+// both lists are sorted the same way.
+class RowDiff
+{
+public:
+    struct Range {
+        int first;
+        int count;
+    };
+
+    // Rows are store rows below rowLimit
+    RowDiff(const QVector<int> &oldRows, const QVector<int> &newRows, int rowLimit);
+
+    // Rows removed plus rows inserted
+    int changeCount() const { return m_changeCount; }
+
+    // Runs of old positions, last first, so each applies to the list as the previous left it
+    const QVector<Range> &removals() const { return m_removals; }
+    // Runs of new positions in ascending order; after the removals and the
+    // earlier insertions, newRows[first..] belongs at position first
+    const QVector<Range> &insertions() const { return m_insertions; }
+
+private:
+    QVector<Range> m_removals;
+    QVector<Range> m_insertions;
+    int m_changeCount;
+};
+
+#endif // ROWDIFF_H
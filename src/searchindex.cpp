@@ -0,0 +1,241 @@
+#include "searchindex.h"
+#include "trackstore.h"
+#include <QtConcurrent>
+#include <QDebug>
+#include <algorithm>
+
+// Title, artist, album and genre, the fields TrackStore::matches() searches
+static const int FieldCount = 4;
+
+// Joins the fields of a document; trigrams across it are not indexed and search terms never contain it
+static const QChar FieldSeparator(0x1f);
+
+SearchIndex::SearchIndex(TrackStore *store, QObject *parent)
+    : QObject(parent)
+    , m_store(store)
+    , m_ready(false)
+{
+    connect(&m_buildWatcher, &QFutureWatcher<Index>::finished, this, &SearchIndex::onBuildFinished);
+    connect(m_store, &TrackStore::tracksReset, this, &SearchIndex::rebuild);
+    connect(m_store, &TrackStore::tracksInserted, this, &SearchIndex::onTracksChanged);
+    connect(m_store, &TrackStore::tracksUpdated, this, &SearchIndex::onTracksChanged);
+    connect(m_store, &TrackStore::tracksRemoved, this, &SearchIndex::onTracksChanged);
+    rebuild();
+}
+
+SearchIndex::~SearchIndex()
+{
+    m_buildWatcher.waitForFinished();
+}
+
+void SearchIndex::rebuild()
+{
+    // Store rows were renumbered, so the old index cannot answer in the meantime
+    m_ready = false;
+    m_index = Index();
+    m_pendingRows.clear();
+    m_lastTerm.clear();
+    m_lastResult.clear();
+
+    // Copying the strings only takes references; folding and indexing run on the worker
+    QVector<QString> fields;
+    fields.reserve(m_store->size() * FieldCount);
+    for (int row = 0; row < m_store->size(); ++row) {
+        if (m_store->id(row) < 0) {
+            fields.resize(fields.size() + FieldCount);
+            continue;
+        }
+        fields << m_store->title(row) << m_store->artist(row) << m_store->album(row) << m_store->genre(row);
+    }
+
+    // Replacing the future drops the result of a build that is still running
+    m_buildWatcher.setFuture(QtConcurrent::run(&SearchIndex::build, fields));
+}
+
+void SearchIndex::onBuildFinished()
+{
+    m_index = m_buildWatcher.result();
+
+    // Catch up with rows the store changed while the build ran
+    for (int row : std::as_const(m_pendingRows)) {
+        reindexRow(row);
+    }
+    m_pendingRows.clear();
+
+    m_ready = true;
+    qDebug() << "Search index holds" << m_index.documents.size() << "rows and"
+             << m_index.postings.size() << "trigrams";
+    emit ready();
+}
+
+void SearchIndex::onTracksChanged(const QVector<int> &rows)
+{
+    m_lastTerm.clear();
+    m_lastResult.clear();
+
+    if (!m_ready) {
+        m_pendingRows += rows;
+        return;
+    }
+    for (int row : rows) {
+        reindexRow(row);
+    }
+}
+
+void SearchIndex::reindexRow(int row)
+{
+    if (row >= m_index.documents.size()) {
+        m_index.documents.resize(row + 1);
+    }
+
+    const QString oldDocument = m_index.documents.at(row);
+    const QString newDocument = m_store->id(row) >= 0 ? document(row) : QString();
+    if (oldDocument == newDocument) {
+        return;
+    }
+
+    for (quint64 trigram : trigrams(oldDocument)) {
+        auto it = m_index.postings.find(trigram);
+        if (it == m_index.postings.end()) {
+            continue;
+        }
+        QVector<int> &rows = it.value();
+        auto position = std::lower_bound(rows.begin(), rows.end(), row);
+        if (position != rows.end() && *position == row) {
+            rows.erase(position);
+        }
+        if (rows.isEmpty()) {
+            m_index.postings.erase(it);
+        }
+    }
+
+    for (quint64 trigram : trigrams(newDocument)) {
+        // The store appends new rows, so this is normally the end of the list
+        QVector<int> &rows = m_index.postings[trigram];
+        rows.insert(std::lower_bound(rows.begin(), rows.end(), row), row);
+    }
+
+    m_index.documents[row] = newDocument;
+}
+
+QString SearchIndex::document(int row) const
+{
+    const QString fields[FieldCount] = {
+        m_store->title(row), m_store->artist(row), m_store->album(row), m_store->genre(row)
+    };
+    return foldDocument(fields);
+}
+
+QVector<int> SearchIndex::search(const QString &searchTerm)
+{
+    const QString term = searchTerm.toCaseFolded();
+    if (term.isEmpty()) {
+        return QVector<int>();
+    }
+
+    QVector<int> candidates;
+    if (!m_lastTerm.isEmpty() && term.contains(m_lastTerm)) {
+        // Typing on: everything the new term matches, the previous one matched too
+        candidates = m_lastResult;
+    } else if (term.size() >= 3) {
+        // Intersect the posting lists, shortest first
+        QVector<const QVector<int>*> lists;
+        for (quint64 trigram : trigrams(term)) {
+            auto it = m_index.postings.constFind(trigram);
+            if (it == m_index.postings.constEnd()) {
+                lists.clear();
+                break;
+            }
+            lists.append(&it.value());
+        }
+        std::sort(lists.begin(), lists.end(), [](const QVector<int> *left, const QVector<int> *right) {
+            return left->size() < right->size();
+        });
+
+        if (!lists.isEmpty()) {
+            candidates = *lists.first();
+            QVector<int> intersection;
+            for (int i = 1; i < lists.size() && !candidates.isEmpty(); ++i) {
+                intersection.clear();
+                std::set_intersection(candidates.cbegin(), candidates.cend(), lists.at(i)->cbegin(),
+                                      lists.at(i)->cend(), std::back_inserter(intersection));
+                candidates.swap(intersection);
+            }
+        }
+    } else {
+        // Too short for a trigram; one pass over the documents
+        candidates.reserve(m_index.documents.size());
+        for (int row = 0; row < m_index.documents.size(); ++row) {
+            candidates.append(row);
+        }
+    }
+
+    // Trigrams only narrow the candidates; the substring test decides
+    QVector<int> result;
+    for (int row : std::as_const(candidates)) {
+        if (m_index.documents.at(row).contains(term)) {
+            result.append(row);
+        }
+    }
+
+    m_lastTerm = term;
+    m_lastResult = result;
+    return result;
+}
+
+SearchIndex::Index SearchIndex::build(const QVector<QString> &fields)
+{
+    Index index;
+    const int rowCount = fields.size() / FieldCount;
+    index.documents.resize(rowCount);
+
+    // Rows are visited in order, so every posting list comes out sorted
+    for (int row = 0; row < rowCount; ++row) {
+        const QString document = foldDocument(fields.constData() + row * FieldCount);
+        for (quint64 trigram : trigrams(document)) {
+            index.postings[trigram].append(row);
+        }
+        index.documents[row] = document;
+    }
+
+    return index;
+}
+
+QString SearchIndex::foldDocument(const QString *fields)
+{
+    QString document;
+    for (int field = 0; field < FieldCount; ++field) {
+        if (field > 0) {
+            document += FieldSeparator;
+        }
+        document += fields[field];
+    }
+
+    // Removed rows and rows without any text have nothing to find
+    if (document.size() == FieldCount - 1) {
+        return QString();
+    }
+    return document.toCaseFolded();
+}
+
+QVector<quint64> SearchIndex::trigrams(const QString &text)
+{
+    QVector<quint64> result;
+    if (text.size() < 3) {
+        return result;
+    }
+
+    result.reserve(text.size() - 2);
+    const QChar *data = text.constData();
+    for (int i = 0; i + 2 < text.size(); ++i) {
+        if (data[i] == FieldSeparator || data[i + 1] == FieldSeparator || data[i + 2] == FieldSeparator) {
+            continue;
+        }
+        result.append((quint64(data[i].unicode()) << 32) | (quint64(data[i + 1].unicode()) << 16)
+                      | data[i + 2].unicode());
+    }
+
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
@@ -0,0 +1,65 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QObject>
+#include <QVector>
+#include <QHash>
+#include <QString>
+#include <QFutureWatcher>
+
+class TrackStore;
+
+// In-memory trigram index over the searchable fields of the TrackStore
+// (title, artist, album, genre), so search-as-you-type never goes to the
+// database. Each row's fields are case-folded into one document; a posting
+// list per trigram holds the rows whose document contains it, in row order.
+// A query intersects the lists of its trigrams and confirms the survivors
+// with a substring match, which gives the same results as
+// TrackStore::matches(). A query that extends the previous one only
+// filters the previous results.
+//
+// The index is built on the global thread pool after every store reset and
+// then follows the store's incremental changes. Until the first build
+// finishes isReady() is false and callers should search the database.
+class SearchIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SearchIndex(TrackStore *store, QObject *parent = nullptr);
+    ~SearchIndex();
+
+    bool isReady() const { return m_ready; }
+
+    // Store rows matching the term, in store order
+    QVector<int> search(const QString &searchTerm);
+
+signals:
+    void ready();
+
+private:
+    struct Index {
+        QVector<QString> documents; // By store row; empty for removed rows
+        QHash<quint64, QVector<int>> postings;
+    };
+
+    TrackStore *m_store;
+    Index m_index;
+    bool m_ready;
+    QFutureWatcher<Index> m_buildWatcher;
+    QVector<int> m_pendingRows; // Changed while a build was running
+    QString m_lastTerm;
+    QVector<int> m_lastResult;
+
+    void rebuild();
+    void onBuildFinished();
+    void onTracksChanged(const QVector<int> &rows);
+    void reindexRow(int row);
+    QString document(int row) const;
+
+    static Index build(const QVector<QString> &fields);
+    static QString foldDocument(const QString *fields);
+    static QVector<quint64> trigrams(const QString &text);
+};
+
+#endif // SEARCHINDEX_H
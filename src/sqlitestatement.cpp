@@ -0,0 +1,120 @@
+#include "sqlitestatement.h"
+#include <QDebug>
+#include <sqlite3.h>
+
+SqliteStatement::SqliteStatement(sqlite3 *db, const QString &sql)
+    : m_db(db)
+    , m_statement(nullptr)
+    , m_lastResult(SQLITE_OK)
+{
+    const QByteArray utf8 = sql.toUtf8();
+    if (sqlite3_prepare_v2(m_db, utf8.constData(), utf8.size(), &m_statement, nullptr) != SQLITE_OK) {
+        sqlite3_finalize(m_statement);
+        m_statement = nullptr;
+    }
+}
+
+SqliteStatement::~SqliteStatement()
+{
+    sqlite3_finalize(m_statement);
+}
+
+QString SqliteStatement::errorString() const
+{
+    return QString::fromUtf8(sqlite3_errmsg(m_db));
+}
+
+void SqliteStatement::bind(int index, int value)
+{
+    sqlite3_bind_int(m_statement, index, value);
+}
+
+void SqliteStatement::bind(int index, qint64 value)
+{
+    sqlite3_bind_int64(m_statement, index, value);
+}
+
+void SqliteStatement::bind(int index, const QString &value)
+{
+    const QByteArray utf8 = value.toUtf8();
+    sqlite3_bind_text(m_statement, index, utf8.constData(), utf8.size(), SQLITE_TRANSIENT);
+}
+
+void SqliteStatement::bind(int index, const QVariant &value)
+{
+    if (value.isNull()) {
+        bindNull(index);
+        return;
+    }
+
+    switch (value.typeId()) {
+        case QMetaType::Int:
+        case QMetaType::UInt:
+        case QMetaType::Bool:
+            bind(index, value.toInt());
+            break;
+        case QMetaType::LongLong:
+        case QMetaType::ULongLong:
+            bind(index, value.toLongLong());
+            break;
+        default:
+            bind(index, value.toString());
+            break;
+    }
+}
+
+void SqliteStatement::bindNull(int index)
+{
+    sqlite3_bind_null(m_statement, index);
+}
+
+bool SqliteStatement::step()
+{
+    m_lastResult = sqlite3_step(m_statement);
+    if (m_lastResult == SQLITE_ROW) {
+        return true;
+    }
+    if (m_lastResult != SQLITE_DONE && m_lastResult != SQLITE_INTERRUPT) {
+        qWarning() << "sqlite3_step failed:" << errorString();
+    }
+    return false;
+}
+
+bool SqliteStatement::wasInterrupted() const
+{
+    return m_lastResult == SQLITE_INTERRUPT;
+}
+
+bool SqliteStatement::hasFailed() const
+{
+    return m_lastResult != SQLITE_OK && m_lastResult != SQLITE_ROW && m_lastResult != SQLITE_DONE;
+}
+
+void SqliteStatement::reset()
+{
+    sqlite3_reset(m_statement);
+}
+
+bool SqliteStatement::isNull(int column) const
+{
+    return sqlite3_column_type(m_statement, column) == SQLITE_NULL;
+}
+
+int SqliteStatement::columnInt(int column) const
+{
+    return sqlite3_column_int(m_statement, column);
+}
+
+qint64 SqliteStatement::columnInt64(int column) const
+{
+    return sqlite3_column_int64(m_statement, column);
+}
+
+QString SqliteStatement::columnText(int column) const
+{
+    const char *text = reinterpret_cast<const char *>(sqlite3_column_text(m_statement, column));
+    if (!text) {
+        return QString();
+    }
+    return QString::fromUtf8(text, sqlite3_column_bytes(m_statement, column));
+}
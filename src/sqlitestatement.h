@@ -0,0 +1,52 @@
+#ifndef SQLITESTATEMENT_H
+#define SQLITESTATEMENT_H
+
+#include <QString>
+#include <QVariant>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+// Thin RAII wrapper over a prepared sqlite3 statement. Columns are read by
+// position straight into typed values, skipping QSqlQuery's per-row QVariant
+// boxing and name lookups. Used by DatabaseManager for bulk track reads.
+class SqliteStatement
+{
+public:
+    SqliteStatement(sqlite3 *db, const QString &sql);
+    ~SqliteStatement();
+
+    SqliteStatement(const SqliteStatement &) = delete;
+    SqliteStatement &operator=(const SqliteStatement &) = delete;
+
+    bool isValid() const { return m_statement != nullptr; }
+    QString errorString() const;
+
+    // Parameters are 1-based, as in the sqlite3 API
+    void bind(int index, int value);
+    void bind(int index, qint64 value);
+    void bind(int index, const QString &value);
+    void bind(int index, const QVariant &value);
+    void bindNull(int index);
+
+    // Advances to the next row; returns false when done or on error
+    bool step();
+    // True if the last step() stopped because sqlite3_interrupt() was called
+    bool wasInterrupted() const;
+    // True if the last step() stopped on an error (an interrupt included) rather than the end
+    bool hasFailed() const;
+    void reset();
+
+    // Columns are 0-based
+    bool isNull(int column) const;
+    int columnInt(int column) const;
+    qint64 columnInt64(int column) const;
+    QString columnText(int column) const;
+
+private:
+    sqlite3 *m_db;
+    sqlite3_stmt *m_statement;
+    int m_lastResult;
+};
+
+#endif // SQLITESTATEMENT_H
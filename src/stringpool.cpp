@@ -0,0 +1,53 @@
+#include "stringpool.h"
+
+StringPool::StringPool()
+    : m_sortKeysEnabled(false)
+{
+}
+
+int StringPool::intern(const QString &value)
+{
+    auto it = m_keys.constFind(value);
+    if (it != m_keys.constEnd()) {
+        return it.value();
+    }
+
+    const int key = m_values.size();
+    m_values.append(value);
+    m_keys.insert(value, key);
+    if (m_sortKeysEnabled) {
+        m_sortKeys.push_back(m_collator.sortKey(value));
+    }
+    return key;
+}
+
+void StringPool::enableSortKeys(const QCollator &collator)
+{
+    if (m_sortKeysEnabled) {
+        return;
+    }
+
+    m_collator = collator;
+    m_sortKeys.reserve(m_values.size());
+    for (const QString &value : m_values) {
+        m_sortKeys.push_back(m_collator.sortKey(value));
+    }
+    m_sortKeysEnabled = true;
+}
+
+int StringPool::compare(int left, int right) const
+{
+    if (left == right) {
+        return 0;
+    }
+    return m_sortKeys[left].compare(m_sortKeys[right]);
+}
+
+void StringPool::clear()
+{
+    m_values.clear();
+    m_keys.clear();
+    // Recomputed on demand for the next contents
+    m_sortKeys.clear();
+    m_sortKeysEnabled = false;
+}
@@ -0,0 +1,42 @@
+#ifndef STRINGPOOL_H
+#define STRINGPOOL_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QCollator>
+#include <vector>
+
+// Interns strings as dense integer keys. Each distinct value is stored once,
+// and callers keep the key, so equality and grouping are int comparisons
+// and per-key lookups can use plain vectors. Keys are never reused until
+// clear(), which invalidates all of them.
+class StringPool
+{
+public:
+    StringPool();
+
+    int intern(const QString &value);
+    int key(const QString &value) const { return m_keys.value(value, -1); }
+    const QString &value(int key) const { return m_values.at(key); }
+    int size() const { return m_values.size(); }
+    // Indexed by key; implicitly shared, so copying is cheap
+    const QVector<QString> &values() const { return m_values; }
+
+    // Collation keys for every value, kept up to date by intern() once
+    // enabled, so compare() never collates strings itself
+    void enableSortKeys(const QCollator &collator);
+    bool hasSortKeys() const { return m_sortKeysEnabled; }
+    int compare(int left, int right) const;
+
+    void clear();
+
+private:
+    QVector<QString> m_values;
+    QHash<QString, int> m_keys;
+    QCollator m_collator;
+    std::vector<QCollatorSortKey> m_sortKeys;
+    bool m_sortKeysEnabled;
+};
+
+#endif // STRINGPOOL_H
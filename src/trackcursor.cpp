@@ -0,0 +1,50 @@
+#include "trackcursor.h"
+
+TrackCursor::TrackCursor(DatabaseManager *dbManager, DatabaseManager::SortColumn column,
+                         Qt::SortOrder order, int pageSize, const QString &searchTerm)
+    : m_dbManager(dbManager)
+    , m_column(column)
+    , m_order(order)
+    , m_pageSize(qMax(1, pageSize))
+    , m_searchTerm(searchTerm)
+    , m_lastId(-1)
+    , m_atEnd(false)
+{
+}
+
+QList<MusicTrack> TrackCursor::fetchNextPage()
+{
+    if (m_atEnd) {
+        return QList<MusicTrack>();
+    }
+
+    QList<MusicTrack> page = m_dbManager->getTrackPage(m_column, m_order, m_lastValue, m_lastId,
+                                                       m_pageSize, m_searchTerm);
+
+    // A failed page may be short or empty; stop instead of reporting the end
+    if (m_dbManager->lastQueryFailed()) {
+        m_errorString = m_dbManager->lastQueryError();
+        m_atEnd = true;
+        return QList<MusicTrack>();
+    }
+
+    if (page.size() < m_pageSize) {
+        m_atEnd = true;
+    }
+
+    if (!page.isEmpty()) {
+        const MusicTrack &last = page.last();
+        m_lastValue = DatabaseManager::sortValue(m_column, last);
+        m_lastId = last.id;
+    }
+
+    return page;
+}
+
+void TrackCursor::reset()
+{
+    m_lastValue.clear();
+    m_lastId = -1;
+    m_atEnd = false;
+    m_errorString.clear();
+}
@@ -0,0 +1,43 @@
+#ifndef TRACKCURSOR_H
+#define TRACKCURSOR_H
+
+#include <QList>
+#include <QString>
+#include <QVariant>
+#include "databasemanager.h"
+
+// Streams the tracks table in fixed-size pages using keyset pagination.
+// Only the sort value and id of the last row are kept between pages, so
+// fetching page N costs the same as fetching the first one.
+class TrackCursor
+{
+public:
+    TrackCursor(DatabaseManager *dbManager, DatabaseManager::SortColumn column,
+                Qt::SortOrder order = Qt::AscendingOrder, int pageSize = 1000,
+                const QString &searchTerm = QString());
+
+    // An empty page with hasError() set means the read failed, not that the data ended
+    QList<MusicTrack> fetchNextPage();
+    bool atEnd() const { return m_atEnd; }
+    bool hasError() const { return !m_errorString.isEmpty(); }
+    QString errorString() const { return m_errorString; }
+    void reset();
+
+    DatabaseManager::SortColumn sortColumn() const { return m_column; }
+    Qt::SortOrder sortOrder() const { return m_order; }
+    int pageSize() const { return m_pageSize; }
+
+private:
+    DatabaseManager *m_dbManager;
+    DatabaseManager::SortColumn m_column;
+    Qt::SortOrder m_order;
+    int m_pageSize;
+    QString m_searchTerm;
+
+    QVariant m_lastValue;
+    int m_lastId;
+    bool m_atEnd;
+    QString m_errorString;
+};
+
+#endif // TRACKCURSOR_H
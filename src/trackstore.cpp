@@ -0,0 +1,391 @@
+#include "trackstore.h"
+#include <QDebug>
+
+TrackStore::TrackStore(DatabaseManager *dbManager, QObject *parent)
+    : QObject(parent)
+    , m_dbManager(dbManager)
+    , m_revision(0)
+    , m_titleSortKeysReady(false)
+    , m_catalogSortKeysReady(false)
+{
+}
+
+void TrackStore::reload()
+{
+    const qint64 revision = m_dbManager->currentRevision();
+    setTracks(m_dbManager->getAllTracks(), revision);
+}
+
+void TrackStore::setTracks(const QList<MusicTrack> &tracks, qint64 revision)
+{
+    clear();
+    m_revision = revision;
+    reserve(tracks.size());
+    for (const MusicTrack &track : tracks) {
+        append(track);
+    }
+
+    qDebug() << "Track store holds" << size() << "tracks";
+    emit tracksReset();
+}
+
+void TrackStore::updateFromDatabase()
+{
+    const TrackChanges changes = m_dbManager->getChangesSince(m_revision);
+    if (!changes.complete) {
+        qDebug() << "Track store is behind the pruned tombstones; reloading";
+        reload();
+        return;
+    }
+    m_revision = changes.revision;
+    if (changes.isEmpty()) {
+        return;
+    }
+
+    // Models locate rows by their current values, so warn them before any is written
+    QVector<int> changing;
+    for (int trackId : changes.removedTrackIds) {
+        const int row = rowForId(trackId);
+        if (row >= 0) {
+            changing.append(row);
+        }
+    }
+    for (const MusicTrack &track : changes.changedTracks) {
+        const int row = rowForId(track.id);
+        if (row >= 0) {
+            changing.append(row);
+        }
+    }
+    if (!changing.isEmpty()) {
+        emit tracksAboutToChange(changing);
+    }
+
+    // Removed rows are only unlinked, so the numbers held by the models stay valid
+    QVector<int> removed;
+    for (int trackId : changes.removedTrackIds) {
+        auto it = m_rowById.find(trackId);
+        if (it == m_rowById.end()) {
+            continue;
+        }
+        m_ids[it.value()] = -1;
+        removed.append(it.value());
+        m_rowById.erase(it);
+    }
+
+    QVector<int> updated;
+    QVector<int> inserted;
+    for (const MusicTrack &track : changes.changedTracks) {
+        const int row = rowForId(track.id);
+        if (row >= 0) {
+            assign(row, track);
+            updated.append(row);
+        } else {
+            inserted.append(append(track));
+        }
+    }
+
+    if (!removed.isEmpty()) {
+        emit tracksRemoved(removed);
+    }
+    if (!updated.isEmpty()) {
+        emit tracksUpdated(updated);
+    }
+    if (!inserted.isEmpty()) {
+        emit tracksInserted(inserted);
+    }
+}
+
+bool TrackStore::matches(int row, const QString &searchTerm) const
+{
+    return title(row).contains(searchTerm, Qt::CaseInsensitive)
+        || artist(row).contains(searchTerm, Qt::CaseInsensitive)
+        || album(row).contains(searchTerm, Qt::CaseInsensitive)
+        || genre(row).contains(searchTerm, Qt::CaseInsensitive);
+}
+
+QVector<int> TrackStore::matchingRows(const QString &searchTerm) const
+{
+    QVector<int> rows;
+    for (int row = 0; row < size(); ++row) {
+        if (m_ids.at(row) >= 0 && matches(row, searchTerm)) {
+            rows.append(row);
+        }
+    }
+    return rows;
+}
+
+QVector<int> TrackStore::allRows() const
+{
+    QVector<int> rows;
+    rows.reserve(m_rowById.size());
+    for (int row = 0; row < size(); ++row) {
+        if (m_ids.at(row) >= 0) {
+            rows.append(row);
+        }
+    }
+    return rows;
+}
+
+QVector<int> TrackStore::rowsFor(const QList<MusicTrack> &tracks) const
+{
+    QVector<int> rows;
+    rows.reserve(tracks.size());
+
+    // Only maps ids. Writing here would change rows behind the models' sorted
+    // orders and the search index; tracks the store has not seen yet, and
+    // newer copies of ones it has, arrive through updateFromDatabase()
+    for (const MusicTrack &track : tracks) {
+        const int row = rowForId(track.id);
+        if (row >= 0) {
+            rows.append(row);
+        }
+    }
+
+    return rows;
+}
+
+void TrackStore::prepareSortKeys(TextColumn column)
+{
+    switch (column) {
+        case TitleText:
+            if (!m_titleSortKeysReady) {
+                m_titleSortKeys.reserve(m_titles.size());
+                for (const QString &title : m_titles) {
+                    m_titleSortKeys.push_back(m_collator.sortKey(title));
+                }
+                m_titleSortKeysReady = true;
+            }
+            break;
+        case CatalogNumberText:
+            if (!m_catalogSortKeysReady) {
+                m_catalogSortKeys.reserve(m_catalogNumbers.size());
+                for (const QString &catalogNumber : m_catalogNumbers) {
+                    m_catalogSortKeys.push_back(m_collator.sortKey(catalogNumber));
+                }
+                m_catalogSortKeysReady = true;
+            }
+            break;
+        case ArtistText:
+            m_artists.enableSortKeys(m_collator);
+            break;
+        case AlbumText:
+            m_albums.enableSortKeys(m_collator);
+            break;
+        case GenreText:
+            m_genres.enableSortKeys(m_collator);
+            break;
+        case PublisherText:
+            m_publishers.enableSortKeys(m_collator);
+            break;
+    }
+}
+
+int TrackStore::compareText(TextColumn column, int left, int right) const
+{
+    // Preparing here would race with parallel sorts, so callers prepare first
+    switch (column) {
+        case TitleText:
+            Q_ASSERT_X(m_titleSortKeysReady, "TrackStore::compareText", "prepareSortKeys() not called");
+            return m_titleSortKeys[left].compare(m_titleSortKeys[right]);
+        case CatalogNumberText:
+            Q_ASSERT_X(m_catalogSortKeysReady, "TrackStore::compareText", "prepareSortKeys() not called");
+            return m_catalogSortKeys[left].compare(m_catalogSortKeys[right]);
+        case ArtistText:
+            Q_ASSERT_X(m_artists.hasSortKeys(), "TrackStore::compareText", "prepareSortKeys() not called");
+            return m_artists.compare(m_artistKeys.at(left), m_artistKeys.at(right));
+        case AlbumText:
+            Q_ASSERT_X(m_albums.hasSortKeys(), "TrackStore::compareText", "prepareSortKeys() not called");
+            return m_albums.compare(m_albumKeys.at(left), m_albumKeys.at(right));
+        case GenreText:
+            Q_ASSERT_X(m_genres.hasSortKeys(), "TrackStore::compareText", "prepareSortKeys() not called");
+            return m_genres.compare(m_genreKeys.at(left), m_genreKeys.at(right));
+        case PublisherText:
+            Q_ASSERT_X(m_publishers.hasSortKeys(), "TrackStore::compareText", "prepareSortKeys() not called");
+            return m_publishers.compare(m_publisherKeys.at(left), m_publisherKeys.at(right));
+    }
+    return 0;
+}
+
+TrackStore::GroupingColumns TrackStore::groupingColumns() const
+{
+    GroupingColumns columns;
+    columns.artistIds = m_artistIds;
+    columns.albumIds = m_albumIds;
+    columns.genreIds = m_genreIds;
+    columns.years = m_years;
+    columns.artistKeys = m_artistKeys;
+    columns.albumKeys = m_albumKeys;
+    columns.genreKeys = m_genreKeys;
+    columns.artistNames = m_artists.values();
+    columns.albumNames = m_albums.values();
+    columns.genreNames = m_genres.values();
+    return columns;
+}
+
+MusicTrack TrackStore::track(int row) const
+{
+    MusicTrack track;
+    if (row < 0 || row >= size()) {
+        return track;
+    }
+
+    track.id = m_ids.at(row);
+    track.filePath = m_filePaths.at(row);
+    track.directoryId = m_directoryIds.at(row);
+    track.title = m_titles.at(row);
+    track.artistId = m_artistIds.at(row);
+    track.albumId = m_albumIds.at(row);
+    track.genreId = m_genreIds.at(row);
+    track.publisherId = m_publisherIds.at(row);
+    track.artist = m_artists.value(m_artistKeys.at(row));
+    track.album = m_albums.value(m_albumKeys.at(row));
+    track.genre = m_genres.value(m_genreKeys.at(row));
+    track.publisher = m_publishers.value(m_publisherKeys.at(row));
+    track.catalogNumber = m_catalogNumbers.at(row);
+    track.year = m_years.at(row);
+    track.track = m_trackNumbers.at(row);
+    track.duration = m_durations.at(row);
+    track.fileSize = m_fileSizes.at(row);
+    track.mtimeNs = m_mtimesNs.at(row);
+    track.revision = m_revisions.at(row);
+    track.fieldSet = m_fieldSets.at(row);
+    track.extractorVersion = m_extractorVersions.at(row);
+    return track;
+}
+
+QList<MusicTrack> TrackStore::tracks(const QVector<int> &rows) const
+{
+    QList<MusicTrack> result;
+    result.reserve(rows.size());
+    for (int row : rows) {
+        result.append(track(row));
+    }
+    return result;
+}
+
+void TrackStore::clear()
+{
+    m_rowById.clear();
+    m_ids.clear();
+    m_directoryIds.clear();
+    m_filePaths.clear();
+    m_titles.clear();
+    m_artistIds.clear();
+    m_albumIds.clear();
+    m_genreIds.clear();
+    m_publisherIds.clear();
+    m_artistKeys.clear();
+    m_artists.clear();
+    m_albumKeys.clear();
+    m_albums.clear();
+    m_genreKeys.clear();
+    m_genres.clear();
+    m_publisherKeys.clear();
+    m_publishers.clear();
+    m_catalogNumbers.clear();
+    m_years.clear();
+    m_trackNumbers.clear();
+    m_durations.clear();
+    m_fileSizes.clear();
+    m_mtimesNs.clear();
+    m_revisions.clear();
+    m_fieldSets.clear();
+    m_extractorVersions.clear();
+    m_titleSortKeys.clear();
+    m_catalogSortKeys.clear();
+    m_titleSortKeysReady = false;
+    m_catalogSortKeysReady = false;
+}
+
+void TrackStore::reserve(int size)
+{
+    m_rowById.reserve(size);
+    m_ids.reserve(size);
+    m_directoryIds.reserve(size);
+    m_filePaths.reserve(size);
+    m_titles.reserve(size);
+    m_artistIds.reserve(size);
+    m_albumIds.reserve(size);
+    m_genreIds.reserve(size);
+    m_publisherIds.reserve(size);
+    m_artistKeys.reserve(size);
+    m_albumKeys.reserve(size);
+    m_genreKeys.reserve(size);
+    m_publisherKeys.reserve(size);
+    m_catalogNumbers.reserve(size);
+    m_years.reserve(size);
+    m_trackNumbers.reserve(size);
+    m_durations.reserve(size);
+    m_fileSizes.reserve(size);
+    m_mtimesNs.reserve(size);
+    m_revisions.reserve(size);
+    m_fieldSets.reserve(size);
+    m_extractorVersions.reserve(size);
+}
+
+int TrackStore::append(const MusicTrack &track)
+{
+    const int row = size();
+    m_ids.append(track.id);
+    m_directoryIds.append(track.directoryId);
+    m_filePaths.append(track.filePath);
+    m_titles.append(track.title);
+    m_artistIds.append(track.artistId);
+    m_albumIds.append(track.albumId);
+    m_genreIds.append(track.genreId);
+    m_publisherIds.append(track.publisherId);
+    m_artistKeys.append(m_artists.intern(track.artist));
+    m_albumKeys.append(m_albums.intern(track.album));
+    m_genreKeys.append(m_genres.intern(track.genre));
+    m_publisherKeys.append(m_publishers.intern(track.publisher));
+    m_catalogNumbers.append(track.catalogNumber);
+    m_years.append(track.year);
+    m_trackNumbers.append(track.track);
+    m_durations.append(track.duration);
+    m_fileSizes.append(track.fileSize);
+    m_mtimesNs.append(track.mtimeNs);
+    m_revisions.append(track.revision);
+    m_fieldSets.append(track.fieldSet);
+    m_extractorVersions.append(track.extractorVersion);
+    if (m_titleSortKeysReady) {
+        m_titleSortKeys.push_back(m_collator.sortKey(track.title));
+    }
+    if (m_catalogSortKeysReady) {
+        m_catalogSortKeys.push_back(m_collator.sortKey(track.catalogNumber));
+    }
+
+    if (track.id >= 0) {
+        m_rowById.insert(track.id, row);
+    }
+    return row;
+}
+
+void TrackStore::assign(int row, const MusicTrack &track)
+{
+    m_directoryIds[row] = track.directoryId;
+    m_filePaths[row] = track.filePath;
+    m_titles[row] = track.title;
+    m_artistIds[row] = track.artistId;
+    m_albumIds[row] = track.albumId;
+    m_genreIds[row] = track.genreId;
+    m_publisherIds[row] = track.publisherId;
+    m_artistKeys[row] = m_artists.intern(track.artist);
+    m_albumKeys[row] = m_albums.intern(track.album);
+    m_genreKeys[row] = m_genres.intern(track.genre);
+    m_publisherKeys[row] = m_publishers.intern(track.publisher);
+    m_catalogNumbers[row] = track.catalogNumber;
+    m_years[row] = track.year;
+    m_trackNumbers[row] = track.track;
+    m_durations[row] = track.duration;
+    m_fileSizes[row] = track.fileSize;
+    m_mtimesNs[row] = track.mtimeNs;
+    m_revisions[row] = track.revision;
+    m_fieldSets[row] = track.fieldSet;
+    m_extractorVersions[row] = track.extractorVersion;
+    if (m_titleSortKeysReady) {
+        m_titleSortKeys[row] = m_collator.sortKey(track.title);
+    }
+    if (m_catalogSortKeysReady) {
+        m_catalogSortKeys[row] = m_collator.sortKey(track.catalogNumber);
+    }
+}
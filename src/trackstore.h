@@ -0,0 +1,167 @@
+#ifndef TRACKSTORE_H
+#define TRACKSTORE_H
+
+#include <QObject>
+#include <QVector>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QCollator>
+#include <vector>
+#include "databasemanager.h"
+#include "stringpool.h"
+
+// The in-memory library shared by the tree and flat models. Each field lives
+// in its own column vector and a track is addressed by its row, so the
+// models hold plain int rows instead of copying MusicTrack values. Rows stay
+// valid until the next reload() or setTracks(), which emit tracksReset().
+// Artist, album, genre and publisher are interned per column: rows hold
+// small integer keys, so grouping code can compare and index by key.
+class TrackStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum TextColumn {
+        TitleText = 0,
+        ArtistText,
+        AlbumText,
+        GenreText,
+        PublisherText,
+        CatalogNumberText
+    };
+
+    // Implicitly shared copies of the columns the library tree groups by.
+    // Later changes to the store detach from them, so a copy can be read
+    // on another thread while the store keeps changing.
+    struct GroupingColumns {
+        QVector<int> artistIds;
+        QVector<int> albumIds;
+        QVector<int> genreIds;
+        QVector<int> years;
+        QVector<int> artistKeys;
+        QVector<int> albumKeys;
+        QVector<int> genreKeys;
+        QVector<QString> artistNames; // By key
+        QVector<QString> albumNames;
+        QVector<QString> genreNames;
+    };
+
+    explicit TrackStore(DatabaseManager *dbManager, QObject *parent = nullptr);
+
+    // Replaces the contents with the whole library, in database order or the given order
+    void reload();
+    void setTracks(const QList<MusicTrack> &tracks, qint64 revision);
+    // Applies rows written or deleted since revision() without a reset
+    void updateFromDatabase();
+    qint64 revision() const { return m_revision; }
+
+    // Rows for tracks fetched elsewhere (searches, per-album queries). Tracks
+    // not in the store yet are left out; updateFromDatabase() adds them.
+    QVector<int> rowsFor(const QList<MusicTrack> &tracks) const;
+    int rowForId(int trackId) const { return m_rowById.value(trackId, -1); }
+
+    // Rows ever handed out, including removed ones; allRows() lists the live ones
+    int size() const { return m_ids.size(); }
+    QVector<int> allRows() const;
+
+    int id(int row) const { return m_ids.at(row); }
+    const QString &filePath(int row) const { return m_filePaths.at(row); }
+    const QString &title(int row) const { return m_titles.at(row); }
+    const QString &artist(int row) const { return m_artists.value(m_artistKeys.at(row)); }
+    const QString &album(int row) const { return m_albums.value(m_albumKeys.at(row)); }
+    const QString &genre(int row) const { return m_genres.value(m_genreKeys.at(row)); }
+    const QString &publisher(int row) const { return m_publishers.value(m_publisherKeys.at(row)); }
+    const QString &catalogNumber(int row) const { return m_catalogNumbers.at(row); }
+    int year(int row) const { return m_years.at(row); }
+    int trackNumber(int row) const { return m_trackNumbers.at(row); }
+    int duration(int row) const { return m_durations.at(row); }
+    int artistId(int row) const { return m_artistIds.at(row); }
+    int albumId(int row) const { return m_albumIds.at(row); }
+    int genreId(int row) const { return m_genreIds.at(row); }
+
+    // In-memory version of the database search condition (title, artist, album, genre)
+    bool matches(int row, const QString &searchTerm) const;
+    // Live rows that match, in store order; a linear scan, for when no SearchIndex is ready
+    QVector<int> matchingRows(const QString &searchTerm) const;
+
+    // Interned keys; equal keys mean equal strings within one column
+    int artistKey(int row) const { return m_artistKeys.at(row); }
+    int albumKey(int row) const { return m_albumKeys.at(row); }
+    int genreKey(int row) const { return m_genreKeys.at(row); }
+    int publisherKey(int row) const { return m_publisherKeys.at(row); }
+    int artistKeyCount() const { return m_artists.size(); }
+    int albumKeyCount() const { return m_albums.size(); }
+    int genreKeyCount() const { return m_genres.size(); }
+    const QString &artistName(int key) const { return m_artists.value(key); }
+    const QString &albumName(int key) const { return m_albums.value(key); }
+    const QString &genreName(int key) const { return m_genres.value(key); }
+
+    // Locale-aware order of a text column. prepareSortKeys() computes one
+    // collation key per value (per distinct value for interned columns) and
+    // keeps them current as rows change; compareText() then only compares
+    // keys and must not be called for a column that was not prepared.
+    void prepareSortKeys(TextColumn column);
+    int compareText(TextColumn column, int left, int right) const;
+
+    GroupingColumns groupingColumns() const;
+
+    // Materialises one row, e.g. to hand to the player
+    MusicTrack track(int row) const;
+    QList<MusicTrack> tracks(const QVector<int> &rows) const;
+
+signals:
+    void tracksReset();
+    // Emitted by updateFromDatabase() before it rewrites or unlinks these rows,
+    // while they still hold the values the models sorted them by
+    void tracksAboutToChange(const QVector<int> &rows);
+    // Incremental changes from updateFromDatabase(); existing rows keep their numbers
+    void tracksInserted(const QVector<int> &rows);
+    void tracksUpdated(const QVector<int> &rows);
+    void tracksRemoved(const QVector<int> &rows);
+
+private:
+    DatabaseManager *m_dbManager;
+    QHash<int, int> m_rowById;
+    qint64 m_revision; // Library revision the contents reflect
+
+    QVector<int> m_ids;
+    QVector<int> m_directoryIds;
+    QVector<QString> m_filePaths;
+    QVector<QString> m_titles;
+    QVector<int> m_artistIds;
+    QVector<int> m_albumIds;
+    QVector<int> m_genreIds;
+    QVector<int> m_publisherIds;
+    QVector<int> m_artistKeys;
+    QVector<int> m_albumKeys;
+    QVector<int> m_genreKeys;
+    QVector<int> m_publisherKeys;
+    StringPool m_artists;
+    StringPool m_albums;
+    StringPool m_genres;
+    StringPool m_publishers;
+    QVector<QString> m_catalogNumbers;
+    QVector<int> m_years;
+    QVector<int> m_trackNumbers;
+    QVector<int> m_durations;
+    QVector<qint64> m_fileSizes;
+    QVector<qint64> m_mtimesNs;
+    QVector<qint64> m_revisions;
+    QVector<int> m_fieldSets;
+    QVector<int> m_extractorVersions;
+
+    // Per-row collation keys for the columns that are not interned
+    QCollator m_collator;
+    std::vector<QCollatorSortKey> m_titleSortKeys;
+    std::vector<QCollatorSortKey> m_catalogSortKeys;
+    bool m_titleSortKeysReady;
+    bool m_catalogSortKeysReady;
+
+    void clear();
+    void reserve(int size);
+    int append(const MusicTrack &track);
+    void assign(int row, const MusicTrack &track);
+};
+
+#endif // TRACKSTORE_H